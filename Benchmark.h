@@ -0,0 +1,139 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+/*
+    Small benchmark harness shared by the Sec*.cpp programs.
+    The first measure_time (Sec1 and Sec2) timed a single call with system_clock, which can jump (it follows the clock of the system),
+        and the result of the call was never used, so the compiler was allowed to remove the computation.
+    Here :
+        - the time is measured with steady_clock, which is monotonic ;
+        - a few calls are made before measuring (warm-up : caches, memory allocations, frequency of the processor) ;
+        - the function is called nb_trials times and we keep the minimum, the median and the 10% and 90% percentiles ;
+        - the result of each call goes through do_not_optimize, so the compiler has to compute it ;
+        - from the number of operations and of bytes of one call (given by the caller), we get GFLOP/s and GB/s ;
+        - all the results can be written in CSV or JSON, to compare two versions of the code.
+*/
+
+using bench_clock = std::chrono::steady_clock;
+
+/*
+    The empty assembly instruction "uses" the address of value and may read or write any memory :
+        the compiler cannot remove the computation of value, nor move it outside of the timed part.
+*/
+template <class T>
+    inline void do_not_optimize(const T & value){
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+struct BenchmarkResult{
+    std::string name;
+    std::string parameters; // For example "N=150 n=1000"
+    int nb_trials;
+    double min;
+    double median;
+    double p10;
+    double p90;
+    double mean;
+    double flops; // Number of floating point operations of one call (0 if unknown)
+    double bytes; // Number of bytes read and written by one call (0 if unknown)
+    double gflops() const {return flops / median * 1e-9;}
+    double gbytes() const {return bytes / median * 1e-9;}
+};
+
+/*
+    Value at the position q (between 0 and 1) of the sorted times, with linear interpolation.
+*/
+inline double percentile(const std::vector<double> & sorted_times, double q){
+    double position = q * (sorted_times.size() - 1);
+    size_t k = std::floor(position);
+    if(k + 1 >= sorted_times.size()){
+        return sorted_times.back();
+    }
+    return sorted_times[k] + (position - k) * (sorted_times[k + 1] - sorted_times[k]);
+}
+
+template <class FUNC>
+    BenchmarkResult run_benchmark(const std::string & name, const std::string & parameters, FUNC func,
+                                  double flops = 0, double bytes = 0, int nb_warmup = 2, int nb_trials = 10){
+        for(int k = 0; k < nb_warmup; k++){
+            auto result = func();
+            do_not_optimize(result);
+        }
+        std::vector<double> times(nb_trials);
+        for(auto & time : times){
+            auto start = bench_clock::now();
+            auto result = func();
+            do_not_optimize(result);
+            std::chrono::duration<double> duration = bench_clock::now() - start;
+            time = duration.count();
+        }
+        std::sort(times.begin(), times.end());
+        double mean = std::accumulate(times.begin(), times.end(), 0.) / nb_trials;
+        return {name, parameters, nb_trials, times.front(), percentile(times, 0.5), percentile(times, 0.1), percentile(times, 0.9), mean, flops, bytes};
+    }
+
+class BenchmarkReport{
+    private :
+        std::vector<BenchmarkResult> results;
+    public :
+        void add(const BenchmarkResult & result) {results.push_back(result);}
+        void print(std::ostream & out) const; // Table for the terminal
+        void write_csv(std::ostream & out) const;
+        void write_json(std::ostream & out) const;
+};
+
+inline void BenchmarkReport::print(std::ostream & out) const{
+    for(const auto & r : results){
+        out << r.name << " (" << r.parameters << ") : median " << r.median << " s, min " << r.min
+            << " s, p10-p90 [" << r.p10 << ", " << r.p90 << "] s";
+        if(r.flops > 0) out << ", " << r.gflops() << " GFLOP/s";
+        if(r.bytes > 0) out << ", " << r.gbytes() << " GB/s";
+        out << "\n";
+    }
+}
+
+inline void BenchmarkReport::write_csv(std::ostream & out) const{
+    out << "name,parameters,trials,min,median,p10,p90,mean,flops,bytes,gflops,gbytes_per_s\n";
+    for(const auto & r : results){
+        out << r.name << "," << r.parameters << "," << r.nb_trials << "," << r.min << "," << r.median << "," << r.p10 << "," << r.p90 << ","
+            << r.mean << "," << r.flops << "," << r.bytes << "," << r.gflops() << "," << r.gbytes() << "\n";
+    }
+}
+
+inline void BenchmarkReport::write_json(std::ostream & out) const{
+    out << "[\n";
+    for(size_t k = 0; k < results.size(); k++){
+        const auto & r = results[k];
+        out << "  {\"name\": \"" << r.name << "\", \"parameters\": \"" << r.parameters << "\", \"trials\": " << r.nb_trials
+            << ", \"min\": " << r.min << ", \"median\": " << r.median << ", \"p10\": " << r.p10 << ", \"p90\": " << r.p90
+            << ", \"mean\": " << r.mean << ", \"flops\": " << r.flops << ", \"bytes\": " << r.bytes
+            << ", \"gflops\": " << r.gflops() << ", \"gbytes_per_s\": " << r.gbytes() << "}" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]\n";
+}
+
+/*
+    Writes the report in the file (JSON if its name ends with .json, CSV otherwise) and prints it.
+*/
+inline void save_benchmark_report(const BenchmarkReport & report, const std::string & filename){
+    report.print(std::cout);
+    std::ofstream output(filename);
+    if(filename.size() >= 5 && filename.compare(filename.size() - 5, 5, ".json") == 0){
+        report.write_json(output);
+    }
+    else{
+        report.write_csv(output);
+    }
+    std::cout << "Results written in " << filename << "\n";
+}
+
+#endif
@@ -0,0 +1,219 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+/*
+    Instrumentation by phases (generation, reduction, iterations, binning, ...).
+    A phase is a small integer (0 <= phase < max_nb_phases) chosen by the program. Writing
+        PHASE_TIMER(phase);
+    at the beginning of a block adds the time spent in this block to the phase, and counts one call.
+    Each thread accumulates in its own ThreadProfile (no lock, no allocation during the measures). When a thread ends,
+        its profile is copied in a global list, and print_phase_report prints the total of each phase and the detail for each thread.
+
+    Compilation :
+        - without option, PHASE_TIMER does nothing and the instrumentation costs nothing ;
+        - -DINSTRUMENTATION : time of each phase (steady_clock) ;
+        - -DINSTRUMENTATION -DINSTRUMENTATION_PERF (Linux only) : also the hardware counters of each thread, read with perf_event_open :
+          cycles, instructions and cache misses (there is no portable counter of floating point operations).
+          If the system does not allow these counters (for example in a container), they are simply not printed.
+*/
+
+#ifdef INSTRUMENTATION
+
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#ifdef INSTRUMENTATION_PERF
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const int max_nb_phases = 16;
+const int nb_counters = 3;
+const char * const counter_names[nb_counters] = {"cycles", "instructions", "cache misses"};
+
+struct PhaseStatistics{
+    double time = 0;
+    long nb_calls = 0;
+    uint64_t counters[nb_counters] = {0, 0, 0};
+};
+
+struct ProfileData{
+    int thread_number;
+    PhaseStatistics phases[max_nb_phases];
+};
+
+class ThreadProfile : public ProfileData{
+    private :
+        int counter_fd[nb_counters];
+    public :
+        ThreadProfile(); // constructor
+        ThreadProfile(const ThreadProfile &) = delete;
+        ThreadProfile & operator =(const ThreadProfile &) = delete;
+        ~ThreadProfile(); // Saves the profile in the global list
+        bool has_counters() const {return this-> counter_fd[0] >= 0;}
+        void read_counters(uint64_t values[nb_counters]) const;
+};
+
+/*
+    Profiles of the threads that have ended, and number of threads created.
+*/
+inline std::mutex & profiles_mutex(){
+    static std::mutex m;
+    return m;
+}
+inline std::vector<ProfileData> & finished_profiles(){
+    static std::vector<ProfileData> profiles;
+    return profiles;
+}
+inline int new_thread_number(){
+    static int nb_threads = 0;
+    std::lock_guard<std::mutex> lock(profiles_mutex());
+    return nb_threads++;
+}
+
+inline ThreadProfile::ThreadProfile() : ProfileData{new_thread_number(), {}}{
+    for(int k = 0; k < nb_counters; k++){
+        counter_fd[k] = -1;
+    }
+#ifdef INSTRUMENTATION_PERF
+    const uint64_t configs[nb_counters] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+    for(int k = 0; k < nb_counters; k++){
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.size = sizeof(attributes);
+        attributes.config = configs[k];
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        counter_fd[k] = syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0); // This thread, any processor
+        if(counter_fd[k] < 0){ // Not allowed : no counter at all
+            for(int l = 0; l < k; l++){
+                close(counter_fd[l]);
+                counter_fd[l] = -1;
+            }
+            break;
+        }
+    }
+#endif
+}
+
+inline ThreadProfile::~ThreadProfile(){
+    std::lock_guard<std::mutex> lock(profiles_mutex());
+    finished_profiles().push_back(*this);
+#ifdef INSTRUMENTATION_PERF
+    for(int k = 0; k < nb_counters; k++){
+        if(counter_fd[k] >= 0) close(counter_fd[k]);
+    }
+#endif
+}
+
+inline void ThreadProfile::read_counters(uint64_t values[nb_counters]) const{
+    for(int k = 0; k < nb_counters; k++){
+        values[k] = 0;
+#ifdef INSTRUMENTATION_PERF
+        if(counter_fd[k] >= 0 && read(counter_fd[k], &values[k], sizeof(uint64_t)) != sizeof(uint64_t)){
+            values[k] = 0;
+        }
+#endif
+    }
+}
+
+inline ThreadProfile & thread_profile(){
+    thread_local ThreadProfile profile;
+    return profile;
+}
+
+class ScopedPhaseTimer{
+    private :
+        ThreadProfile & profile;
+        int phase;
+        std::chrono::steady_clock::time_point start;
+        uint64_t start_counters[nb_counters];
+    public :
+        ScopedPhaseTimer(int phase) : profile(thread_profile()), phase(phase){ // constructor
+            if(profile.has_counters()) profile.read_counters(start_counters);
+            start = std::chrono::steady_clock::now();
+        }
+        ~ScopedPhaseTimer(){
+            std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+            PhaseStatistics & statistics = profile.phases[phase];
+            statistics.time += time.count();
+            statistics.nb_calls++;
+            if(profile.has_counters()){
+                uint64_t end_counters[nb_counters];
+                profile.read_counters(end_counters);
+                for(int k = 0; k < nb_counters; k++){
+                    statistics.counters[k] += end_counters[k] - start_counters[k];
+                }
+            }
+        }
+};
+
+#define PHASE_TIMER_NAME(line) phase_timer_##line
+#define PHASE_TIMER_LINE(phase, line) ScopedPhaseTimer PHASE_TIMER_NAME(line)(phase)
+#define PHASE_TIMER(phase) PHASE_TIMER_LINE(phase, __LINE__)
+
+/*
+    Total of each phase over all the threads (those that have ended, and the calling thread), then the detail for each thread.
+    phase_names[k] is the name of the phase k.
+*/
+inline void print_phase_report(std::ostream & out, const std::vector<std::string> & phase_names){
+    std::vector<ProfileData> profiles;
+    {
+        std::lock_guard<std::mutex> lock(profiles_mutex());
+        profiles = finished_profiles();
+    }
+    const ThreadProfile & current = thread_profile();
+    auto print_phases = [&](const PhaseStatistics * phases, const std::string & indent){
+        for(size_t p = 0; p < phase_names.size(); p++){
+            if(phases[p].nb_calls == 0) continue;
+            out << indent << phase_names[p] << " : " << phases[p].time << " s, " << phases[p].nb_calls << " calls";
+            for(int k = 0; k < nb_counters; k++){
+                if(phases[p].counters[k] > 0) out << ", " << phases[p].counters[k] << " " << counter_names[k];
+            }
+            out << "\n";
+        }
+    };
+    PhaseStatistics total[max_nb_phases];
+    auto add = [&](const ProfileData & profile){
+        for(int p = 0; p < max_nb_phases; p++){
+            total[p].time += profile.phases[p].time;
+            total[p].nb_calls += profile.phases[p].nb_calls;
+            for(int k = 0; k < nb_counters; k++){
+                total[p].counters[k] += profile.phases[p].counters[k];
+            }
+        }
+    };
+    for(const auto & profile : profiles){
+        add(profile);
+    }
+    add(current);
+    out << "Time by phase (all threads) :\n";
+    print_phases(total, "  ");
+    for(const auto & profile : profiles){
+        out << "  thread " << profile.thread_number << " :\n";
+        print_phases(profile.phases, "    ");
+    }
+    if(!current.has_counters()){
+#ifdef INSTRUMENTATION_PERF
+        out << "  (hardware counters not available on this system)\n";
+#endif
+    }
+}
+
+#else
+
+#define PHASE_TIMER(phase)
+#include <ostream>
+#include <string>
+#include <vector>
+inline void print_phase_report(std::ostream &, const std::vector<std::string> &) {}
+
+#endif
+
+#endif
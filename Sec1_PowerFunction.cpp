@@ -3,11 +3,12 @@
 #include <Eigen/Sparse>
 #include <chrono>
 #include <fstream>
+#include "Benchmark.h"
 
 
 
 using namespace std;
-using timer = std::chrono::system_clock;
+using timer = std::chrono::steady_clock; // Monotonic clock : system_clock can jump when the time of the system is changed
 
 /*
 A matrix with real coefficients and a fixed size of N × M at the time of writing the program can be declared as :
@@ -61,29 +62,32 @@ MatrixDouble slow_power_without_ampersand(MatrixDouble M, int n){
         all the coefficients of the matrix and its powers from 1 to n are copied. In the case of A^100, this would result in 900 copies.
 */
 
-MatrixDouble fast_power(const MatrixDouble & M, int n){
-    if(n == 0){
-        return MatrixDouble::Identity(M.rows(),M.cols());
-    }
-    else if (n == 1) {
-        return M;
-    }
-    else if(n % 2 == 0){  // Case when n is an even number (n = 2k, k integer)
-        MatrixDouble N(M.rows(),M.cols());
-        N = fast_power(M, n / 2);
-        /*
-        * Be careful here :
-        *   return puissance_rapide(M, n/2) * puissance_rapide(M, n/2);
-        * the program calculates the half power twice, and there is no time gain.
-        */
-        return N * N;
-    }
-    else{ // Case where n is an odd number (n = 2k + 1, k integer)
-        MatrixDouble N(M.rows(),M.cols());
-        N = fast_power(M, n / 2); // Same as (n-1) / 2 : This is Euclidean (integer) division, so if n = 2k + 1, then n / 2 equals to k
-        // It gives the same result directly, so even if I use (n-1) / 2, it is also correct.
-        return M * N * N;
+/*
+    First version of fast_power, recursive :
+        M^0 = Id,  M^n = M^(n/2) * M^(n/2) if n is even,  M^n = M * M^((n-1)/2) * M^((n-1)/2) if n is odd.
+    It allocates new matrices at each level of the recursion, and M * N * N makes two products with a temporary matrix.
+    
+    The version below does the same computation without recursion : we read the bits of n from the lowest one, 
+        square goes through M, M^2, M^4, M^8, ... and is multiplied into result when the corresponding bit of n is 1.
+    The products are written in temp with noalias() (the destination is not one of the operands, so Eigen does not need a temporary), 
+        and then temp is exchanged with result or square : swap only exchanges the pointers, no coefficient is copied.
+*/
+MatrixDouble fast_power(const MatrixDouble & M, unsigned long n){
+    MatrixDouble result = MatrixDouble::Identity(M.rows(),M.cols());
+    MatrixDouble square = M;
+    MatrixDouble temp(M.rows(),M.cols());
+    while(n > 0){
+        if(n % 2 == 1){
+            temp.noalias() = result * square;
+            result.swap(temp);
+        }
+        n /= 2;
+        if(n > 0){
+            temp.noalias() = square * square;
+            square.swap(temp);
+        }
     }
+    return result;
 }
 
 
@@ -93,25 +97,23 @@ MatrixDouble fast_power(const MatrixDouble & M, int n){
     ----------------------------------------------------------------------------------------------------------------------------
 */
 
-SparseMatrix sparse_power(const SparseMatrix & M, int n){
-	if(n==0){
-		SparseMatrix Id(M.rows(),M.cols());
-		Id.setIdentity();	//cf. https://eigen.tuxfamily.org/dox/classEigen_1_1SparseMatrix.html
-		return Id;
-	}
-	else if(n == 1){
-		return M;
+SparseMatrix sparse_power(const SparseMatrix & M, unsigned long n){
+	SparseMatrix result(M.rows(),M.cols());
+	result.setIdentity();	//cf. https://eigen.tuxfamily.org/dox/classEigen_1_1SparseMatrix.html
+	SparseMatrix square = M;
+	SparseMatrix temp(M.rows(),M.cols());
+	while(n > 0){ // Same loop as fast_power (noalias does not exist for sparse products)
+		if(n % 2 == 1){
+			temp = result * square;
+			result.swap(temp);
+		}
+		n /= 2;
+		if(n > 0){
+			temp = square * square;
+			square.swap(temp);
+		}
 	}
-	else if(n % 2 == 0){
-		SparseMatrix N (M.rows(), M.cols());
-		N = sparse_power(M, n / 2);
-		return N*N;
-	}
-	else { //casse n % 2 == 1 (odd number)
-		SparseMatrix N(M.rows(), M.cols());
-		N = sparse_power(M, n / 2);
-		return M * N*  N;
-    }
+	return result;
 }
 
 int main(){
@@ -124,6 +126,7 @@ int main(){
         chrono::duration<double> computation_time;
         auto start = timer::now();
         auto result = func(A, power);
+        do_not_optimize(result); // The result is not used : without this, the compiler could remove the computation
         auto end = timer::now();
         computation_time = end - start;
         return computation_time.count();
@@ -136,20 +139,20 @@ int main(){
 
     // Time measurement for slow_power (by reference)
     double time_with_ampersand_toThePower100 = measure_time(slow_power, A, 100);
-    cout << "The computation time for A^10000 (using the ampersand) is : " << time_with_ampersand_toThePower100 << "s\n";
+    cout << "The computation time for A^100 (using the ampersand) is : " << time_with_ampersand_toThePower100 << "s\n";
 
     // Time measurement for slow_power_without_ampersand (by value)
     double time_without_ampersand_toThePower100 = measure_time(slow_power_without_ampersand, A, 100);
-    cout << "The computation time for A^10000 (without the ampersand) is : " << time_without_ampersand_toThePower100 << "s\n";
+    cout << "The computation time for A^100 (without the ampersand) is : " << time_without_ampersand_toThePower100 << "s\n";
     
     cout << "\n**************************************\n";
     /*************************************************************************************************************************************/
     
     double time_with_ampersand_toThePower1000 = measure_time(slow_power, A, 1000);
-    cout << "The computation time for A^10000 (using the ampersand) is : " << time_with_ampersand_toThePower1000 << "s\n";
+    cout << "The computation time for A^1000 (using the ampersand) is : " << time_with_ampersand_toThePower1000 << "s\n";
 
     double time_without_ampersand_toThePower1000 = measure_time(slow_power_without_ampersand, A, 1000);
-    cout << "The computation time for A^10000 (without the ampersand) is : " << time_without_ampersand_toThePower1000 << "s\n";
+    cout << "The computation time for A^1000 (without the ampersand) is : " << time_without_ampersand_toThePower1000 << "s\n";
     
     cout << "\n**************************************\n";
     /*************************************************************************************************************************************/
@@ -165,6 +168,7 @@ int main(){
     /*
     On my machine, this is the maximum power choice; in this case, without the ampersand, 
             it does not work for this power value due to several reasons (memory blockage or overflow, recursion issues...)
+    (slow_power calls itself n times, so for a large n the stack overflows. fast_power has no recursion and works for any n.)
 
     double time_with_ampersand_toThePowerTest = measure_time(slow_power, A, 30000);
     cout << "The computation time for A^Test (using the ampersand) is : " << time_with_ampersand_toThePowerTest << "s\n";
@@ -175,15 +179,23 @@ int main(){
     cout << "\n**************************************\n";
     /*************************************************************************************************************************************/
 
+    /*
+    The file is read only once : the dense matrix B is filled, and the non-zero values are kept in a list of triplets (i, j, value). 
+    Building the sparse matrix C with setFromTriplets at the end is much faster than inserting the values one by one with coeffRef.
+    (Sec2 has a loader that also finds the size of the matrix in the file.)
+    */
     const int size_of_matrix = 30;
     MatrixDouble B(size_of_matrix,size_of_matrix);
-    ifstream input_1("matrice.txt");
+    vector<Eigen::Triplet<double>> triplets;
+    ifstream input("matrice.txt");
     for(int i = 0; i < size_of_matrix; i++){
         for(int j = 0; j < size_of_matrix; j++){
-            input_1 >> B(i,j);
+            input >> B(i,j);
+            if (std::abs(B(i,j))> 1e-12)
+                triplets.emplace_back(i,j,B(i,j));
         }
     }
-    input_1.close();
+    input.close();
 
     double time_slow_power = measure_time(slow_power,B,1000);
     cout << "Time taken to compute B^1000 using the first method = " << time_slow_power << " s \n";
@@ -194,16 +206,7 @@ int main(){
     /*************************************************************************************************************************************/
     
     SparseMatrix C(size_of_matrix,size_of_matrix);
-    ifstream input_2("matrice.txt");
-    for (int i = 0; i < size_of_matrix ; i++){
-       for (int j = 0; j < size_of_matrix ; j++){
-        double v;
-        input_2 >> v;
-        if (std::abs(v)> 1e-12)
-            C.coeffRef(i,j) = v;
-        }
-    }
-    input_2.close();
+    C.setFromTriplets(triplets.begin(),triplets.end());
     
     auto start = timer::now();
     SparseMatrix Power_C = sparse_power(C,1000);
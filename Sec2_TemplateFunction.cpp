@@ -1,39 +1,1260 @@
 #include <iostream>
 #include <Eigen/Dense>
 #include <Eigen/Sparse>
+#include <Eigen/Eigenvalues>
+#include <unsupported/Eigen/MatrixFunctions>
+#include <Eigen/SparseLU>
+#include <unsupported/Eigen/IterativeSolvers>
 #include <chrono>
 #include <fstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <charconv>
+#include <stdexcept>
+#include <random>
+#include <cmath>
+#include <complex>
+#include <memory>
+#include <array>
+#include <algorithm>
+#include <limits>
+#include <cctype>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Benchmark.h"
 
 using namespace std;
-using timer = std::chrono::system_clock;
+using timer = std::chrono::steady_clock;
 using MatrixDouble = Eigen::Matrix <double, Eigen::Dynamic, Eigen::Dynamic>;
+using MatrixFloat = Eigen::Matrix <float, Eigen::Dynamic, Eigen::Dynamic>;
 using SparseMatrix = Eigen::SparseMatrix<double>;
 
+/*
+    Loading matrices from files.
+    In the first version, matrice.txt was read twice with ifstream >> and a size of 30 written in the code, 
+        and the sparse matrix was filled with coeffRef, which inserts the coefficients one by one in the compressed storage.
+    
+    1/ MappedFile maps a whole file in memory (mmap) : no copy into a buffer, the system reads the pages when we go through them.
+    2/ The text is parsed by hand with std::from_chars (no stream, no locale) and the size of the matrix is found while reading : 
+       the number of columns is the number of values on each line, the number of rows is the number of non-empty lines.
+    3/ Sparse matrices are built with a list of triplets (i, j, value) and a single call to setFromTriplets.
+    4/ Two other formats : the coordinate format of Matrix Market (.mtx) used for large sparse matrices, 
+       and a raw binary format (a small header then the coefficients column by column, as in memory) 
+       that can be used directly from the mapped file without any copy with MappedMatrix. 
+       The binary format has a sparse version too (the compressed arrays of Eigen), used without copy with MappedSparseMatrix.
+*/
+class MappedFile{
+    private :
+        const char * data;
+        size_t length;
+    public :
+        MappedFile(const string & filename); // constructor
+        ~MappedFile() {if(length > 0) munmap(const_cast<char *>(data),length);}
+        MappedFile(const MappedFile &) = delete;
+        MappedFile & operator =(const MappedFile &) = delete;
+        const char * begin() const {return this-> data;}
+        const char * end() const {return this-> data + this-> length;}
+        size_t size() const {return this-> length;}
+};
+
+MappedFile::MappedFile(const string & filename) : data(nullptr), length(0){
+    int fd = open(filename.c_str(),O_RDONLY);
+    if(fd < 0){
+        throw runtime_error("Cannot open " + filename);
+    }
+    struct stat info;
+    if(fstat(fd,&info) != 0){
+        close(fd);
+        throw runtime_error("Cannot read the size of " + filename);
+    }
+    length = info.st_size;
+    if(length > 0){
+        void * address = mmap(nullptr,length,PROT_READ,MAP_PRIVATE,fd,0);
+        if(address == MAP_FAILED){
+            close(fd);
+            throw runtime_error("Cannot map " + filename);
+        }
+        data = static_cast<const char *>(address);
+    }
+    close(fd);
+}
+
+/*
+    Goes through a text matrix (values separated by spaces or tabulations, one row per line) 
+        and calls store(i, j, value) for each value. Returns the size of the matrix.
+*/
+template <class FUNC>
+    pair<long,long> parse_text_matrix(const MappedFile & file, FUNC store){
+        const char * p = file.begin();
+        const char * end = file.end();
+        long row = 0, col = 0, nb_cols = -1;
+        while(p < end){
+            if(*p == '\n'){
+                if(col > 0){
+                    if(nb_cols < 0) nb_cols = col;
+                    else if(col != nb_cols) throw runtime_error("Line " + to_string(row + 1) + " does not have " + to_string(nb_cols) + " values");
+                    row++;
+                }
+                col = 0;
+                p++;
+            }
+            else if(*p == ' ' || *p == '\t' || *p == '\r'){
+                p++;
+            }
+            else{
+                double value;
+                auto [next, error] = from_chars(p,end,value);
+                if(error != errc()){
+                    throw runtime_error("Invalid value at line " + to_string(row + 1));
+                }
+                store(row,col,value);
+                col++;
+                p = next;
+            }
+        }
+        if(col > 0){ // Last line without '\n'
+            if(nb_cols >= 0 && col != nb_cols) throw runtime_error("Line " + to_string(row + 1) + " does not have " + to_string(nb_cols) + " values");
+            if(nb_cols < 0) nb_cols = col;
+            row++;
+        }
+        return {row, max(nb_cols,0L)};
+    }
+
+MatrixDouble load_dense_text(const string & filename){
+    MappedFile file(filename);
+    vector<double> values; // Row by row, as in the file
+    auto [nb_rows,nb_cols] = parse_text_matrix(file,[&](long, long, double value){values.push_back(value);});
+    return Eigen::Map<Eigen::Matrix<double,Eigen::Dynamic,Eigen::Dynamic,Eigen::RowMajor>>(values.data(),nb_rows,nb_cols);
+}
+
+/*
+    Values whose absolute value is at most threshold are not stored.
+*/
+SparseMatrix load_sparse_text(const string & filename, double threshold = 1e-12){
+    MappedFile file(filename);
+    vector<Eigen::Triplet<double>> triplets;
+    auto [nb_rows,nb_cols] = parse_text_matrix(file,[&](long i, long j, double value){
+        if(std::abs(value) > threshold) triplets.emplace_back(i,j,value);
+    });
+    SparseMatrix M(nb_rows,nb_cols);
+    M.setFromTriplets(triplets.begin(),triplets.end());
+    return M;
+}
+
+/*
+    Matrix Market, coordinate format :
+        %%MatrixMarket matrix coordinate real general     (field : real, integer or pattern ; symmetry : general, symmetric or skew-symmetric)
+        % comments
+        nb_rows nb_cols nb_entries
+        i j value                                          (indices start at 1, one entry per line)
+    For a symmetric matrix only the lower triangular part is in the file, and the other part is added here 
+        (with the opposite sign for a skew-symmetric matrix).
+    The complex and hermitian matrices are not handled : they throw, like a wrong size or an index outside of the matrix.
+*/
+SparseMatrix load_matrix_market(const string & filename){
+    MappedFile file(filename);
+    const char * p = file.begin();
+    const char * end = file.end();
+    auto next_line = [&](){
+        while(p < end && *p != '\n') p++;
+        if(p < end) p++;
+    };
+    auto skip_spaces = [&](){
+        while(p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    };
+    auto read_long = [&](){
+        skip_spaces();
+        long value = 0;
+        auto [next, error] = from_chars(p,end,value);
+        if(error != errc()) throw runtime_error("Invalid Matrix Market file " + filename);
+        p = next;
+        return value;
+    };
+    auto read_double = [&](){
+        skip_spaces();
+        double value = 0;
+        auto [next, error] = from_chars(p,end,value);
+        if(error != errc()) throw runtime_error("Invalid Matrix Market file " + filename);
+        p = next;
+        return value;
+    };
+
+    // The banner has 5 words : %%MatrixMarket matrix coordinate field symmetry (the case does not matter)
+    vector<string> banner;
+    const char * banner_end = find(p,end,'\n');
+    for(const char * q = p; q < banner_end;){
+        while(q < banner_end && isspace(static_cast<unsigned char>(*q))) q++;
+        const char * word = q;
+        while(q < banner_end && !isspace(static_cast<unsigned char>(*q))) q++;
+        if(q > word){
+            banner.emplace_back(word,q);
+            transform(banner.back().begin(),banner.back().end(),banner.back().begin(),[](unsigned char c){return tolower(c);});
+        }
+    }
+    if(banner.size() != 5 || banner[0] != "%%matrixmarket" || banner[1] != "matrix" || banner[2] != "coordinate"){
+        throw runtime_error(filename + " is not a Matrix Market file in coordinate format");
+    }
+    const string & field = banner[3];
+    const string & symmetry = banner[4];
+    if(field != "real" && field != "integer" && field != "pattern"){
+        throw runtime_error(filename + " : the field " + field + " is not handled (real, integer or pattern)");
+    }
+    if(symmetry != "general" && symmetry != "symmetric" && symmetry != "skew-symmetric"){
+        throw runtime_error(filename + " : the symmetry " + symmetry + " is not handled (general, symmetric or skew-symmetric)");
+    }
+    bool pattern = field == "pattern";
+    bool symmetric = symmetry != "general";
+    double mirror_sign = symmetry == "skew-symmetric" ? -1. : 1.;
+    while(p < end && *p == '%'){
+        next_line();
+    }
+    long nb_rows = read_long();
+    long nb_cols = read_long();
+    long nb_entries = read_long();
+    next_line();
+    // Each entry takes at least 4 characters ("i j\n"), which bounds nb_entries before the reserve
+    if(nb_rows < 0 || nb_cols < 0 || nb_entries < 0 || nb_rows > numeric_limits<int>::max() || nb_cols > numeric_limits<int>::max() 
+       || nb_entries > (end - p) / 4 + 1 || (symmetric && nb_rows != nb_cols)){
+        throw runtime_error("Invalid Matrix Market file " + filename);
+    }
+
+    vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(symmetric ? 2 * nb_entries : nb_entries);
+    for(long k = 0; k < nb_entries; k++){
+        long i = read_long() - 1;
+        long j = read_long() - 1;
+        double value = pattern ? 1. : read_double();
+        next_line();
+        if(i < 0 || i >= nb_rows || j < 0 || j >= nb_cols){
+            throw runtime_error("Invalid Matrix Market file " + filename);
+        }
+        triplets.emplace_back(i,j,value);
+        if(symmetric && i != j){
+            triplets.emplace_back(j,i,mirror_sign * value);
+        }
+    }
+    SparseMatrix M(nb_rows,nb_cols);
+    M.setFromTriplets(triplets.begin(),triplets.end());
+    return M;
+}
+
+void save_matrix_market(const string & filename, const SparseMatrix & M){
+    ofstream output(filename);
+    output.precision(17);
+    output << "%%MatrixMarket matrix coordinate real general\n";
+    output << M.rows() << " " << M.cols() << " " << M.nonZeros() << "\n";
+    for(int j = 0; j < M.outerSize(); j++){
+        for(SparseMatrix::InnerIterator it(M,j); it; ++it){
+            output << it.row() + 1 << " " << it.col() + 1 << " " << it.value() << "\n";
+        }
+    }
+}
+
+/*
+    Raw binary format : 8 bytes "EIGENBIN", the number of rows and columns (int64_t), then the coefficients 
+        column by column (double). Since the header is 24 bytes long, the coefficients are aligned on 8 bytes in the mapped file.
+*/
+const char binary_magic[8] = {'E','I','G','E','N','B','I','N'};
+
+void save_binary(const string & filename, const MatrixDouble & M){
+    ofstream output(filename,ios::binary);
+    int64_t dimensions[2] = {M.rows(),M.cols()};
+    output.write(binary_magic,8);
+    output.write(reinterpret_cast<const char *>(dimensions),sizeof(dimensions));
+    output.write(reinterpret_cast<const char *>(M.data()),M.size() * sizeof(double));
+}
+
+/*
+    The matrix is read directly in the mapped file (Eigen::Map) : nothing is copied, 
+        and the matrix is only valid while the MappedMatrix object exists.
+*/
+class MappedMatrix{
+    private :
+        MappedFile file;
+        Eigen::Map<const MatrixDouble> M;
+        static Eigen::Map<const MatrixDouble> map_file(const MappedFile & file, const string & filename);
+    public :
+        MappedMatrix(const string & filename) : file(filename), M(map_file(file,filename)) {}; // constructor
+        const Eigen::Map<const MatrixDouble> & matrix() const {return this-> M;}
+};
+
+Eigen::Map<const MatrixDouble> MappedMatrix::map_file(const MappedFile & file, const string & filename){
+    int64_t dimensions[2];
+    if(file.size() < 8 + sizeof(dimensions) || memcmp(file.begin(),binary_magic,8) != 0){
+        throw runtime_error(filename + " is not a binary matrix file");
+    }
+    memcpy(dimensions,file.begin() + 8,sizeof(dimensions));
+    // Checked before the product rows * cols, which could overflow for a damaged header
+    size_t nb_coefficients = (file.size() - 8 - sizeof(dimensions)) / sizeof(double);
+    if(dimensions[0] < 0 || dimensions[1] < 0 || (dimensions[1] > 0 && size_t(dimensions[0]) > nb_coefficients / size_t(dimensions[1]))
+       || file.size() != 8 + sizeof(dimensions) + dimensions[0] * dimensions[1] * sizeof(double)){
+        throw runtime_error(filename + " does not have the size given in its header");
+    }
+    const double * coefficients = reinterpret_cast<const double *>(file.begin() + 8 + sizeof(dimensions));
+    return Eigen::Map<const MatrixDouble>(coefficients,dimensions[0],dimensions[1]);
+}
+
+/*
+    Sparse binary format : the compressed column storage (CSC) of Eigen, as in memory, so that a very large sparse matrix 
+        can be used directly from the mapped file.
+        - 8 bytes "EIGENCSC", the number of rows, of columns and of non-zeros (int64_t) ;
+        - the outer indices (nb_cols + 1 int32_t : start of each column in the two next arrays) ;
+        - the inner indices (nb_non_zeros int32_t : row of each non-zero, increasing in each column) ;
+        - the values (nb_non_zeros double).
+    Each array is completed with zeros up to a multiple of 8 bytes, so the values are aligned on 8 bytes in the mapped file.
+*/
+const char sparse_binary_magic[8] = {'E','I','G','E','N','C','S','C'};
+
+size_t padded_size(size_t nb_bytes){
+    return (nb_bytes + 7) / 8 * 8;
+}
+
+void save_binary(const string & filename, const SparseMatrix & M){
+    SparseMatrix compressed = M; // The uncompressed storage (after insert) has holes between the columns
+    compressed.makeCompressed();
+    ofstream output(filename,ios::binary);
+    int64_t dimensions[3] = {compressed.rows(),compressed.cols(),compressed.nonZeros()};
+    const char zeros[8] = {};
+    auto write_array = [&](const void * data, size_t nb_bytes){
+        output.write(static_cast<const char *>(data),nb_bytes);
+        output.write(zeros,padded_size(nb_bytes) - nb_bytes);
+    };
+    output.write(sparse_binary_magic,8);
+    output.write(reinterpret_cast<const char *>(dimensions),sizeof(dimensions));
+    write_array(compressed.outerIndexPtr(),(dimensions[1] + 1) * sizeof(SparseMatrix::StorageIndex));
+    write_array(compressed.innerIndexPtr(),dimensions[2] * sizeof(SparseMatrix::StorageIndex));
+    write_array(compressed.valuePtr(),dimensions[2] * sizeof(double));
+}
+
+/*
+    Same as MappedMatrix for the sparse binary format : the three arrays are used in the mapped file (Eigen::Map of a SparseMatrix). 
+    The indices are checked once in the constructor (O(nb_cols + nb_non_zeros), no copy), since a damaged file 
+        would make Eigen read outside of the arrays.
+*/
+class MappedSparseMatrix{
+    private :
+        MappedFile file;
+        Eigen::Map<const SparseMatrix> M;
+        static Eigen::Map<const SparseMatrix> map_file(const MappedFile & file, const string & filename);
+    public :
+        MappedSparseMatrix(const string & filename) : file(filename), M(map_file(file,filename)) {}; // constructor
+        const Eigen::Map<const SparseMatrix> & matrix() const {return this-> M;}
+};
+
+Eigen::Map<const SparseMatrix> MappedSparseMatrix::map_file(const MappedFile & file, const string & filename){
+    using StorageIndex = SparseMatrix::StorageIndex;
+    int64_t dimensions[3];
+    if(file.size() < 8 + sizeof(dimensions) || memcmp(file.begin(),sparse_binary_magic,8) != 0){
+        throw runtime_error(filename + " is not a sparse binary matrix file");
+    }
+    memcpy(dimensions,file.begin() + 8,sizeof(dimensions));
+    const int64_t max_index = numeric_limits<StorageIndex>::max();
+    // Checked before the sizes of the arrays are computed, which could overflow for a damaged header
+    if(dimensions[0] < 0 || dimensions[1] < 0 || dimensions[2] < 0 || dimensions[0] > max_index || dimensions[1] >= max_index 
+       || dimensions[2] > max_index || size_t(dimensions[2]) > file.size() / sizeof(double)){
+        throw runtime_error(filename + " does not have the size given in its header");
+    }
+    size_t outer_bytes = padded_size((dimensions[1] + 1) * sizeof(StorageIndex));
+    size_t inner_bytes = padded_size(dimensions[2] * sizeof(StorageIndex));
+    if(file.size() != 8 + sizeof(dimensions) + outer_bytes + inner_bytes + dimensions[2] * sizeof(double)){
+        throw runtime_error(filename + " does not have the size given in its header");
+    }
+    const char * arrays = file.begin() + 8 + sizeof(dimensions);
+    const StorageIndex * outer = reinterpret_cast<const StorageIndex *>(arrays);
+    const StorageIndex * inner = reinterpret_cast<const StorageIndex *>(arrays + outer_bytes);
+    const double * values = reinterpret_cast<const double *>(arrays + outer_bytes + inner_bytes);
+    if(outer[0] != 0 || outer[dimensions[1]] != dimensions[2]){
+        throw runtime_error(filename + " : invalid outer indices");
+    }
+    for(int64_t j = 0; j < dimensions[1]; j++){
+        if(outer[j + 1] < outer[j]){
+            throw runtime_error(filename + " : invalid outer indices");
+        }
+        for(StorageIndex k = outer[j]; k < outer[j + 1]; k++){
+            if(inner[k] < 0 || inner[k] >= dimensions[0] || (k > outer[j] && inner[k] <= inner[k - 1])){
+                throw runtime_error(filename + " : invalid row index in column " + to_string(j));
+            }
+        }
+    }
+    return Eigen::Map<const SparseMatrix>(dimensions[0],dimensions[1],dimensions[2],outer,inner,values);
+}
+
+/*
+    Backends for the dense products of fast_power.
+    All the products of fast_power go through multiply_into. For dense matrices of dynamic size (float or double), 
+        the product is made by the backend chosen at run time with set_product_backend :
+        - Eigen : the product of Eigen. It only uses several threads when the program is compiled with -fopenmp 
+          (Eigen::setNbThreads), otherwise it runs on one core ;
+        - Blas : dgemm / sgemm of the BLAS library. Only available when the program is compiled with -DPOWER_USE_BLAS 
+          and linked with a BLAS (for example -lopenblas, which is multi-threaded). We call the BLAS directly instead of using 
+          EIGEN_USE_BLAS, which would replace the products of Eigen everywhere : this way both can be compared in the same program ;
+        - Blocked : the kernel below, cache-blocked and multi-threaded (GemmWorkers), without any dependency.
+    The fixed-size matrices (fast_power_fixed_size) always use Eigen, which unrolls their products.
+
+    Blocked kernel (C = A B, column-major, as in the GotoBLAS / BLIS papers) :
+        - the columns of C are split into nb_threads contiguous parts, one per thread : the threads never write in the same place ;
+        - in each part, A and B are cut into blocks : a kc x nc block of B is copied ("packed") in panels of NR columns, 
+          and a mc x kc block of A in panels of MR rows, so that the innermost loop reads both in the order of the memory. 
+          The sizes are chosen so that a panel of B stays in the L1 cache and the block of A in the L2 cache ;
+        - the micro-kernel computes a MR x NR block of C in NR columns of MR coefficients (fixed-size Eigen arrays, 
+          so the products are made with SIMD instructions and the accumulators stay in registers) ;
+        - the packing buffers are thread_local and keep their size, and the threads are created once by set_product_backend 
+          and kept between the products (GemmWorkers) : no thread and no allocation after the first product.
+*/
+enum class ProductBackend {Eigen, Blas, Blocked};
+
+struct ProductSettings{
+    ProductBackend backend = ProductBackend::Eigen;
+    int nb_threads = 1;
+};
+
+ProductSettings & product_settings(){
+    static ProductSettings settings;
+    return settings;
+}
+
+/*
+    Threads of the blocked kernel, kept between the products : run(function, context) calls function(context, part) 
+        for part = 1, ..., size() on the workers and for part = 0 on the calling thread, then waits for all of them. 
+        The task is a function pointer and a pointer to its parameters, so starting a product does not allocate anything. 
+        The products of several calling threads are made one after the other.
+*/
+class GemmWorkers{
+    private :
+        vector<thread> workers;
+        mutex run_mutex; // One product at a time
+        mutex m;
+        condition_variable start_condition;
+        condition_variable done_condition;
+        void (*function)(const void *, int) = nullptr;
+        const void * context = nullptr;
+        uint64_t generation = 0; // Number of products started
+        int nb_pending = 0; // Workers that have not finished the current product
+        bool stopping = false;
+        void work(int part);
+    public :
+        GemmWorkers(int nb_workers); // constructor
+        ~GemmWorkers();
+        GemmWorkers(const GemmWorkers &) = delete;
+        GemmWorkers & operator =(const GemmWorkers &) = delete;
+        int size() const {return this-> workers.size();}
+        void run(void (*function)(const void *, int), const void * context);
+};
+
+GemmWorkers::GemmWorkers(int nb_workers){
+    for(int k = 0; k < nb_workers; k++){
+        workers.emplace_back([this, k](){work(k + 1);});
+    }
+}
+
+GemmWorkers::~GemmWorkers(){
+    {
+        lock_guard<mutex> lock(m);
+        stopping = true;
+    }
+    start_condition.notify_all();
+    for(auto & worker : workers){
+        worker.join();
+    }
+}
+
+void GemmWorkers::work(int part){
+    uint64_t last_generation = 0;
+    unique_lock<mutex> lock(m);
+    while(true){
+        start_condition.wait(lock, [&](){return stopping || generation != last_generation;});
+        if(stopping){
+            return;
+        }
+        last_generation = generation;
+        lock.unlock();
+        function(context, part);
+        lock.lock();
+        if(--nb_pending == 0){
+            done_condition.notify_one();
+        }
+    }
+}
+
+void GemmWorkers::run(void (*function)(const void *, int), const void * context){
+    lock_guard<mutex> run_lock(run_mutex);
+    {
+        lock_guard<mutex> lock(m);
+        this-> function = function;
+        this-> context = context;
+        nb_pending = workers.size();
+        generation++;
+    }
+    start_condition.notify_all();
+    function(context, 0);
+    unique_lock<mutex> lock(m);
+    done_condition.wait(lock, [&](){return nb_pending == 0;});
+}
+
+/*
+    nb_threads - 1 workers (the calling thread makes the first part), only for the blocked backend.
+*/
+unique_ptr<GemmWorkers> & gemm_workers(){
+    static unique_ptr<GemmWorkers> workers;
+    return workers;
+}
+
+bool product_backend_available([[maybe_unused]] ProductBackend backend){
+#ifdef POWER_USE_BLAS
+    return true;
+#else
+    return backend != ProductBackend::Blas;
+#endif
+}
+
+void set_product_backend(ProductBackend backend, int nb_threads = 1){
+    if(!product_backend_available(backend)){
+        throw runtime_error("The BLAS backend needs -DPOWER_USE_BLAS and a BLAS library");
+    }
+    if(nb_threads < 1){
+        throw runtime_error("The number of threads must be at least 1");
+    }
+    product_settings() = {backend, nb_threads};
+    int nb_workers = backend == ProductBackend::Blocked ? nb_threads - 1 : 0;
+    if(!gemm_workers() || gemm_workers()->size() != nb_workers){
+        gemm_workers() = make_unique<GemmWorkers>(nb_workers);
+    }
+#ifdef _OPENMP
+    Eigen::setNbThreads(backend == ProductBackend::Eigen ? nb_threads : 1);
+#endif
+}
+
+string product_backend_name(){
+    const ProductSettings & settings = product_settings();
+    switch(settings.backend){
+        case ProductBackend::Blas :
+            return "blas";
+        case ProductBackend::Blocked :
+            return "blocked (" + to_string(settings.nb_threads) + (settings.nb_threads > 1 ? " threads)" : " thread)");
+        default :
+#ifdef _OPENMP
+            return "eigen+openmp (" + to_string(Eigen::nbThreads()) + " threads)";
+#else
+            return "eigen (1 thread)";
+#endif
+    }
+}
+
+ProductBackend parse_product_backend(const string & name){
+    if(name == "eigen") return ProductBackend::Eigen;
+    if(name == "blas") return ProductBackend::Blas;
+    if(name == "blocked") return ProductBackend::Blocked;
+    throw runtime_error("Unknown backend " + name + " (eigen, blas or blocked)");
+}
+
+#ifdef POWER_USE_BLAS
+extern "C" {
+    void dgemm_(const char * transa, const char * transb, const int * m, const int * n, const int * k, const double * alpha, 
+                const double * a, const int * lda, const double * b, const int * ldb, const double * beta, double * c, const int * ldc);
+    void sgemm_(const char * transa, const char * transb, const int * m, const int * n, const int * k, const float * alpha, 
+                const float * a, const int * lda, const float * b, const int * ldb, const float * beta, float * c, const int * ldc);
+}
+
+template <class Scalar>
+    void blas_gemm(const Scalar * A, const Scalar * B, Scalar * C, int m, int n, int k){
+        const char no_transpose = 'N';
+        const Scalar one = 1, zero = 0;
+        if constexpr (is_same_v<Scalar,double>){
+            dgemm_(&no_transpose, &no_transpose, &m, &n, &k, &one, A, &m, B, &k, &zero, C, &m);
+        }
+        else{
+            sgemm_(&no_transpose, &no_transpose, &m, &n, &k, &one, A, &m, B, &k, &zero, C, &m);
+        }
+    }
+#endif
+
+const int gemm_MR = 8;
+const int gemm_NR = 4;
+const int gemm_MC = 96;
+const int gemm_KC = 256;
+const int gemm_NC = 2048;
+
+/*
+    C(0:m, 0:n) += Ap Bp for one panel of A (MR rows, kc columns) and one panel of B (kc rows, NR columns). 
+    Only the m <= MR rows and n <= NR columns that exist are written (the panels are completed with zeros).
+*/
+template <class Scalar>
+    void gemm_micro_kernel(int kc, const Scalar * Ap, const Scalar * Bp, Scalar * C, int ldc, int m, int n){
+        using Column = Eigen::Array<Scalar, gemm_MR, 1>;
+        Column c[gemm_NR];
+        for(int j = 0; j < gemm_NR; j++){
+            c[j].setZero();
+        }
+        for(int p = 0; p < kc; p++){
+            Column a = Eigen::Map<const Column, Eigen::Aligned16>(Ap + p * gemm_MR);
+            for(int j = 0; j < gemm_NR; j++){
+                c[j] += a * Bp[p * gemm_NR + j];
+            }
+        }
+        for(int j = 0; j < n; j++){
+            for(int i = 0; i < m; i++){
+                C[j * ldc + i] += c[j](i);
+            }
+        }
+    }
+
+/*
+    C = A B for the columns [first_column, last_column) of C, on one thread. A is m x k, B is k x n, all column-major.
+*/
+template <class Scalar>
+    void blocked_gemm_columns(const Scalar * A, const Scalar * B, Scalar * C, int m, int k, int first_column, int last_column){
+        thread_local vector<Scalar> packed_A, packed_B;
+        packed_A.resize(gemm_MC * gemm_KC);
+        packed_B.resize(gemm_KC * gemm_NC);
+        for(int j = first_column; j < last_column; j++){
+            fill(C + size_t(j) * m, C + size_t(j + 1) * m, Scalar(0));
+        }
+        for(int jc = first_column; jc < last_column; jc += gemm_NC){
+            int nc = min(gemm_NC, last_column - jc);
+            for(int pc = 0; pc < k; pc += gemm_KC){
+                int kc = min(gemm_KC, k - pc);
+                // Panels of NR columns of B(pc:pc+kc, jc:jc+nc), row by row
+                for(int jr = 0; jr < nc; jr += gemm_NR){
+                    Scalar * panel = packed_B.data() + size_t(jr) * kc;
+                    for(int p = 0; p < kc; p++){
+                        for(int j = 0; j < gemm_NR; j++){
+                            panel[p * gemm_NR + j] = (jr + j < nc) ? B[size_t(jc + jr + j) * k + pc + p] : Scalar(0);
+                        }
+                    }
+                }
+                for(int ic = 0; ic < m; ic += gemm_MC){
+                    int mc = min(gemm_MC, m - ic);
+                    // Panels of MR rows of A(ic:ic+mc, pc:pc+kc), column by column
+                    for(int ir = 0; ir < mc; ir += gemm_MR){
+                        Scalar * panel = packed_A.data() + size_t(ir) * kc;
+                        for(int p = 0; p < kc; p++){
+                            const Scalar * column = A + size_t(pc + p) * m + ic + ir;
+                            for(int i = 0; i < gemm_MR; i++){
+                                panel[p * gemm_MR + i] = (ir + i < mc) ? column[i] : Scalar(0);
+                            }
+                        }
+                    }
+                    for(int jr = 0; jr < nc; jr += gemm_NR){
+                        for(int ir = 0; ir < mc; ir += gemm_MR){
+                            gemm_micro_kernel(kc, packed_A.data() + size_t(ir) * kc, packed_B.data() + size_t(jr) * kc, 
+                                              C + size_t(jc + jr) * m + ic + ir, m, min(gemm_MR, mc - ir), min(gemm_NR, nc - jr));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+/*
+    Parameters of a product for GemmWorkers::run : the part p of nb_parts computes the columns of its panels of NR columns.
+*/
+template <class Scalar>
+    struct GemmTask{
+        const Scalar * A;
+        const Scalar * B;
+        Scalar * C;
+        int m, n, k;
+        int nb_parts;
+        static void run(const void * context, int part){
+            const GemmTask & task = *static_cast<const GemmTask *>(context);
+            int nb_panels = (task.n + gemm_NR - 1) / gemm_NR;
+            int first = min(task.n, (nb_panels * part / task.nb_parts) * gemm_NR);
+            int last = min(task.n, (nb_panels * (part + 1) / task.nb_parts) * gemm_NR);
+            blocked_gemm_columns(task.A, task.B, task.C, task.m, task.k, first, last);
+        }
+    };
+
+template <class Scalar>
+    void blocked_gemm(const Scalar * A, const Scalar * B, Scalar * C, int m, int n, int k){
+        GemmWorkers * workers = gemm_workers().get();
+        // No worker at all for small products : starting them would cost more than the product
+        if(workers == nullptr || workers->size() == 0 || double(m) * n * k < 1e6){
+            blocked_gemm_columns(A, B, C, m, k, 0, n);
+            return;
+        }
+        GemmTask<Scalar> task = {A, B, C, m, n, k, workers->size() + 1};
+        workers->run(GemmTask<Scalar>::run, &task);
+    }
+
+/*
+    destination = A * B with the selected backend (dense matrices of dynamic size).
+*/
+template <class MatrixType>
+    void dense_product(MatrixType & destination, const MatrixType & A, const MatrixType & B){
+        using Scalar = typename MatrixType::Scalar;
+        const ProductSettings & settings = product_settings();
+        constexpr bool supported = (is_same_v<Scalar,double> || is_same_v<Scalar,float>) && MatrixType::RowsAtCompileTime == Eigen::Dynamic 
+                                   && MatrixType::ColsAtCompileTime == Eigen::Dynamic && !MatrixType::IsRowMajor;
+        if constexpr (supported){
+            if(settings.backend != ProductBackend::Eigen){
+                destination.resize(A.rows(), B.cols());
+#ifdef POWER_USE_BLAS
+                if(settings.backend == ProductBackend::Blas){
+                    blas_gemm(A.data(), B.data(), destination.data(), A.rows(), B.cols(), A.cols());
+                    return;
+                }
+#endif
+                blocked_gemm(A.data(), B.data(), destination.data(), A.rows(), B.cols(), A.cols());
+                return;
+            }
+        }
+        destination.noalias() = A * B;
+    }
+
+/*
+    Iterative version of fast_power (binary exponentiation).
+    The recursive version allocated new matrices at each level, and M * N * N made two products with a temporary matrix.
+    Here we read the bits of n from the lowest one : square goes through M, M^2, M^4, M^8, ... 
+        and is multiplied into result each time the corresponding bit of n is 1. 
+    There is no recursion (the stack does not depend on n, so any n up to 2^64 - 1 works) and at most 2*log2(n) products.
+    
+    All the products are written into the third buffer temp and then exchanged with swap, which only exchanges 
+        the pointers of the two matrices. For dense matrices, noalias() tells Eigen that the destination is not 
+        one of the operands, so the product is written directly into temp without any temporary matrix. 
+    The buffers are kept by the caller in a PowerBuffers object : when the same object is used for many calls 
+        with matrices of the same size, no memory is allocated after the first call (dense matrices only : 
+        the product of sparse matrices always builds a new compressed storage).
+*/
+template <class MatrixType>
+    struct PowerBuffers{
+        MatrixType result;
+        MatrixType square;
+        MatrixType temp;
+    };
+
+template <class MatrixType>
+    void multiply_into(MatrixType & destination, const MatrixType & A, const MatrixType & B){
+        if constexpr (is_base_of_v<Eigen::SparseMatrixBase<MatrixType>,MatrixType>){
+            destination = A * B; // noalias() does not exist for sparse products
+        }
+        else{
+            dense_product(destination, A, B);
+        }
+    }
+
+template <class MatrixType>
+    const MatrixType & fast_power_with_buffers(const MatrixType & M, uint64_t n, PowerBuffers<MatrixType> & buffers){
+        MatrixType & result = buffers.result;
+        MatrixType & square = buffers.square;
+        MatrixType & temp = buffers.temp;
+        if(n == 0){
+            result.resize(M.rows(), M.cols());
+            result.setIdentity();
+            return result;
+        }
+        bool result_is_identity = true; // To avoid the product Id * M^(2^k) for the first bit equal to 1
+        square = M;
+        while(true){
+            if(n & 1){
+                if(result_is_identity){
+                    result = square;
+                    result_is_identity = false;
+                }
+                else{
+                    multiply_into(temp, result, square);
+                    result.swap(temp);
+                }
+            }
+            n >>= 1;
+            if(n == 0){
+                break;
+            }
+            multiply_into(temp, square, square);
+            square.swap(temp);
+        }
+        return result;
+    }
+
+/*
+    Small matrices of fixed size.
+    With Eigen::Dynamic, the coefficients are on the heap and the products go through the general kernels, 
+        which costs much more than the computation itself for a 3 x 3 matrix. With Eigen::Matrix<double, N, N>, 
+        the coefficients are on the stack and Eigen unrolls the products, since it knows N at compile time.
+    fast_power calls fast_power_fixed_size<N> when a dynamic dense matrix has a size N x N with 2 <= N <= max_fixed_size : 
+        the matrix is copied into a fixed-size matrix, the power is computed with it, and the result is copied back.
+*/
+const int max_fixed_size = 16;
+
+template <class MatrixType>
+    MatrixType fast_power(const MatrixType & M, uint64_t n);
+
+template <int N, class MatrixType>
+    MatrixType fast_power_fixed_size(const MatrixType & M, uint64_t n){
+        if constexpr (N > max_fixed_size){
+            return MatrixType(); // Never used : the size is checked before
+        }
+        else if(M.rows() == N){
+            using FixedMatrix = Eigen::Matrix<typename MatrixType::Scalar, N, N>;
+            PowerBuffers<FixedMatrix> buffers;
+            return fast_power_with_buffers(FixedMatrix(M), n, buffers);
+        }
+        else{
+            return fast_power_fixed_size<N + 1>(M, n);
+        }
+    }
+
 template <class MatrixType> 
-    MatrixType fast_power(const MatrixType & M, int n){
-        if (n == 0) {
+    MatrixType fast_power(const MatrixType & M, uint64_t n){
+        if constexpr (!is_base_of_v<Eigen::SparseMatrixBase<MatrixType>,MatrixType> && MatrixType::RowsAtCompileTime == Eigen::Dynamic){
+            if(M.rows() == M.cols() && M.rows() >= 2 && M.rows() <= max_fixed_size){
+                return fast_power_fixed_size<2>(M, n);
+            }
+        }
+        PowerBuffers<MatrixType> buffers;
+        fast_power_with_buffers(M, n, buffers);
+        return std::move(buffers.result);
+    }   
+
+/*
+    When the exponent is known at compile time, the sequence of products is also computed by the compiler :
+        fast_power_fixed_exponent<1000>(A) is compiled into the 14 products of A^1000, without loop and without test on n.
+    It is mostly useful with fixed-size matrices, for which the products are also unrolled.
+*/
+template <uint64_t n, class MatrixType>
+    MatrixType fast_power_fixed_exponent(const MatrixType & M){
+        if constexpr (n == 0){
             MatrixType Id(M.rows(), M.cols());
             Id.setIdentity();
             return Id;
-            } 
-        else if (n == 1) {
+        }
+        else if constexpr (n == 1){
             return M;
-            } 
-        else if (n % 2 == 0) {
-            MatrixType N = fast_power(M, n / 2);
+        }
+        else if constexpr (n % 2 == 0){
+            MatrixType N = fast_power_fixed_exponent<n / 2>(M);
             return N * N;
-            } 
-        else {
-            MatrixType N = fast_power(M, n / 2);
-            return M * N * N;
+        }
+        else{
+            MatrixType N = fast_power_fixed_exponent<n - 1>(M);
+            return M * N;
+        }
+    }
+    
+/*
+    Sparse power with control of the fill-in.
+    The product of two sparse matrices usually has more non-zero coefficients than each of them. For a permutation matrix 
+        (like the one of matrice.txt) all the powers stay sparse, but for a general transition matrix M^n becomes full 
+        after a few squarings, and a full matrix stored in sparse format is much slower than a dense one.
+    
+    sparse_power_adaptive follows the same loop as fast_power_with_buffers, with a matrix that can be sparse or dense (AdaptiveMatrix) :
+        - after each sparse product, the values whose absolute value is smaller than prune_threshold are removed 
+          (with prune_threshold = 0, only the exact zeros are removed) ;
+        - when the density (number of non-zeros / number of coefficients) becomes larger than dense_switch_density, 
+          the matrix is converted to a dense one. A product between a dense and a sparse matrix gives a dense matrix, 
+          so the other matrix can stay sparse as long as it is not full (dense * sparse products).
+    Each product is written in the report with the number of non-zeros after the product, the density and the time.
+*/
+struct SparsePowerOptions{
+    double prune_threshold = 0.;
+    double dense_switch_density = 0.1;
+};
+
+struct SparsePowerStep{
+    string operation; // "square" or "multiply"
+    long nb_non_zeros;
+    double density;
+    bool dense;
+    double time;
+};
+
+class AdaptiveMatrix{
+    private :
+        bool is_dense_;
+        SparseMatrix S;
+        MatrixDouble D;
+    public :
+        AdaptiveMatrix() : is_dense_(false) {}; // constructor
+        AdaptiveMatrix(const SparseMatrix & M) : is_dense_(false), S(M) {}; // constructor
+        bool is_dense() const {return this-> is_dense_;}
+        const SparseMatrix & sparse() const {return this-> S;}
+        const MatrixDouble & dense() const {return this-> D;}
+        long rows() const {return is_dense_ ? D.rows() : S.rows();}
+        long cols() const {return is_dense_ ? D.cols() : S.cols();}
+        long nb_non_zeros() const {return is_dense_ ? D.size() : S.nonZeros();}
+        double density() const {return nb_non_zeros() / (double(rows()) * cols());}
+        void make_dense(); // Converts the matrix to dense format
+        void multiply(const AdaptiveMatrix & A, const AdaptiveMatrix & B, const SparsePowerOptions & options); // *this = A * B
+        MatrixDouble to_dense() const {return is_dense_ ? D : MatrixDouble(S);}
+};
+
+void AdaptiveMatrix::make_dense(){
+    if(!is_dense_){
+        D = S;
+        S = SparseMatrix();
+        is_dense_ = true;
+    }
+}
+
+void AdaptiveMatrix::multiply(const AdaptiveMatrix & A, const AdaptiveMatrix & B, const SparsePowerOptions & options){
+    if(!A.is_dense_ && !B.is_dense_){
+        S = (A.S * B.S).pruned(options.prune_threshold, 1.);
+        D.resize(0,0);
+        is_dense_ = false;
+        if(density() > options.dense_switch_density){
+            make_dense();
+        }
+        return;
+    }
+    if(A.is_dense_ && B.is_dense_){
+        D.noalias() = A.D * B.D;
+    }
+    else if(A.is_dense_){
+        D.noalias() = A.D * B.S;
+    }
+    else{
+        D.noalias() = A.S * B.D;
+    }
+    S = SparseMatrix();
+    is_dense_ = true;
+}
+
+AdaptiveMatrix sparse_power_adaptive(const SparseMatrix & M, uint64_t n, const SparsePowerOptions & options, vector<SparsePowerStep> & report){
+    SparseMatrix Id(M.rows(), M.cols());
+    Id.setIdentity();
+    if(n == 0){
+        return AdaptiveMatrix(Id);
+    }
+    AdaptiveMatrix result;
+    AdaptiveMatrix square(M);
+    AdaptiveMatrix temp;
+    bool result_is_identity = true;
+    if(square.density() > options.dense_switch_density){
+        square.make_dense();
+    }
+    auto step = [&](const string & operation, AdaptiveMatrix & destination, const AdaptiveMatrix & A, const AdaptiveMatrix & B){
+        auto start = timer::now();
+        temp.multiply(A, B, options);
+        swap(destination, temp);
+        chrono::duration<double> time = timer::now() - start;
+        report.push_back({operation, destination.nb_non_zeros(), destination.density(), destination.is_dense(), time.count()});
+    };
+    while(true){
+        if(n & 1){
+            if(result_is_identity){
+                result = square;
+                result_is_identity = false;
             }
-    }   
+            else{
+                step("multiply", result, result, square);
+            }
+        }
+        n >>= 1;
+        if(n == 0){
+            break;
+        }
+        step("square", square, square, square);
+    }
+    return result;
+}
+
+void print_sparse_power_report(ostream & out, const vector<SparsePowerStep> & report){
+    for(size_t k = 0; k < report.size(); k++){
+        out << "  step " << k + 1 << " : " << report[k].operation << ", " << report[k].nb_non_zeros << " non-zeros (density " 
+            << report[k].density << ", " << (report[k].dense ? "dense" : "sparse") << "), " << report[k].time << " s\n";
+    }
+}
+
+/*
+    Random transition matrix (sum of each row = 1) with nb_per_row non-zero coefficients on each row, for the tests.
+*/
+SparseMatrix random_transition_matrix(int size, int nb_per_row, unsigned seed){
+    mt19937 G(seed);
+    uniform_int_distribution<int> column_distribution(0, size - 1);
+    uniform_real_distribution<double> value_distribution(0., 1.);
+    vector<Eigen::Triplet<double>> triplets;
+    for(int i = 0; i < size; i++){
+        vector<double> values(nb_per_row);
+        double sum = 0;
+        for(auto & v : values){
+            v = value_distribution(G);
+            sum += v;
+        }
+        for(auto v : values){
+            triplets.emplace_back(i, column_distribution(G), v / sum); // Two equal columns are added by setFromTriplets
+        }
+    }
+    SparseMatrix P(size, size);
+    P.setFromTriplets(triplets.begin(), triplets.end());
+    return P;
+}
+
+/*
+    Action of a power on vectors : A^n X and X A^n without computing A^n.
+    X is a block of k vectors (N x k for A^n X, k x N for X A^n, for example k initial distributions of a Markov chain 
+        given as rows, since pi_n = pi_0 P^n). The k vectors are multiplied together : during the products they are stored in a row-major 
+        N x k block (VectorBlock), so the k values of one row are contiguous. For a sparse A, Eigen then adds a_ij * row j of the block 
+        to row i for each non-zero a_ij : A is read once per step for all the vectors. With a column-major block, Eigen makes one pass 
+        over A for each column, and k vectors cost more than k separate products.
     
+    Two methods :
+        - n products A * X : about n * nnz(A) * k operations (nnz(A) = N^2 for a dense matrix), and only two N x k buffers ;
+        - compute A^n with fast_power and multiply once : about 2 * log2(n) * N^3 + N^2 * k operations, and an N x N dense matrix.
+    The second one is only chosen when it needs fewer operations and N is at most max_squaring_size 
+        (for a large sparse matrix A^n is full, and would not fit in memory). 
+        A sparse A is converted to a dense matrix first : its powers fill in quickly, and the cost above is the one of dense products.
+*/
+const long max_squaring_size = 2000;
+
+using VectorBlock = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
+
+template <class MatrixType>
+    long nb_non_zeros(const MatrixType & A){
+        if constexpr (is_base_of_v<Eigen::SparseMatrixBase<MatrixType>,MatrixType>){
+            return A.nonZeros();
+        }
+        else{
+            return A.size();
+        }
+    }
+
+template <class MatrixType>
+    bool use_squaring(const MatrixType & A, uint64_t n, long k){
+        double N = A.rows();
+        double repeated_cost = double(n) * nb_non_zeros(A) * k;
+        double squaring_cost = 2. * log2(double(n) + 1.) * N * N * N + N * N * k;
+        return A.rows() <= max_squaring_size && squaring_cost < repeated_cost;
+    }
+
+template <class MatrixType>
+    MatrixDouble power_times_vectors(const MatrixType & A, uint64_t n, const MatrixDouble & X){
+        if(use_squaring(A, n, X.cols())){
+            return fast_power(MatrixDouble(A), n) * X;
+        }
+        VectorBlock current = X;
+        VectorBlock next(X.rows(), X.cols());
+        for(uint64_t step = 0; step < n; step++){
+            next.noalias() = A * current;
+            current.swap(next);
+        }
+        return current;
+    }
+
+/*
+    X A^n = ((A^T)^n X^T)^T : the products are made with A.transpose(), which is only a view on A (nothing is copied), 
+        and the vectors become the columns of the N x k row-major block (as above, the k values of a row are contiguous).
+*/
+template <class MatrixType>
+    MatrixDouble vectors_times_power(const MatrixDouble & X, const MatrixType & A, uint64_t n){
+        if(use_squaring(A, n, X.rows())){
+            return X * fast_power(MatrixDouble(A), n);
+        }
+        VectorBlock current = X.transpose();
+        VectorBlock next(current.rows(), current.cols());
+        for(uint64_t step = 0; step < n; step++){
+            next.noalias() = A.transpose() * current;
+            current.swap(next);
+        }
+        return current.transpose();
+    }
+
+/*
+    Many powers of the same matrix : PowerCache.
+    fast_power redoes all its products for each exponent. If A = V D V^(-1) with D diagonal, then A^n = V D^n V^(-1) 
+        and D^n only needs the n-th power of N numbers : once V, D and V^(-1) are computed (O(N^3), only once), 
+        each power costs one product of matrices, whatever n is, and n can be any real number (principal power of the eigenvalues).
+    Three cases :
+        - A symmetric : SelfAdjointEigenSolver, V is orthogonal (V^(-1) = V^T) and everything is real ;
+        - A diagonalizable : EigenSolver, V and D are complex, and the real part of the result is returned 
+          (for a non-integer n, the result is only real if A has no negative eigenvalue) ;
+        - if V is ill-conditioned (condition number larger than max_condition, for example when A is not diagonalizable), 
+          V D^n V^(-1) is not accurate anymore. Then we use Eigen::MatrixPower (unsupported module MatrixFunctions) : 
+          repeated squaring for the integer part of n, and the Schur decomposition (computed once) for the fractional part.
+    MatrixPower keeps a reference to the matrix : A is allocated on the heap, so that its address does not change 
+        when the PowerCache is moved.
+*/
+class PowerCache{
+    public :
+        enum class Method {Symmetric, Diagonalization, Squaring};
+    private :
+        unique_ptr<MatrixDouble> A;
+        Method method_;
+        double condition_number_;
+        Eigen::VectorXcd eigenvalues;
+        Eigen::MatrixXcd V;
+        Eigen::MatrixXcd V_inverse;
+        unique_ptr<Eigen::MatrixPower<MatrixDouble>> matrix_power; // Keeps a reference to *A
+    public :
+        PowerCache(const MatrixDouble & M, double max_condition = 1e8); // constructor
+        Method method() const {return this-> method_;}
+        string method_name() const;
+        double condition_number() const {return this-> condition_number_;}
+        MatrixDouble operator ()(double n) const; // A^n
+};
+
+PowerCache::PowerCache(const MatrixDouble & M, double max_condition) : A(make_unique<MatrixDouble>(M)), method_(Method::Squaring), condition_number_(1.){
+    if(A->isApprox(A->transpose())){
+        Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver(*A);
+        eigenvalues = Solver.eigenvalues().cast<complex<double>>();
+        V = Solver.eigenvectors().cast<complex<double>>();
+        V_inverse = V.transpose();
+        method_ = Method::Symmetric;
+        return;
+    }
+    Eigen::EigenSolver<MatrixDouble> Solver(*A);
+    Eigen::JacobiSVD<Eigen::MatrixXcd> svd(Solver.eigenvectors());
+    const auto & singular_values = svd.singularValues();
+    condition_number_ = singular_values(0) / singular_values(singular_values.size() - 1);
+    if(condition_number_ <= max_condition){
+        eigenvalues = Solver.eigenvalues();
+        V = Solver.eigenvectors();
+        V_inverse = V.inverse();
+        method_ = Method::Diagonalization;
+    }
+    else{
+        matrix_power = make_unique<Eigen::MatrixPower<MatrixDouble>>(*A);
+    }
+}
+
+string PowerCache::method_name() const{
+    switch(method_){
+        case Method::Symmetric : return "symmetric eigendecomposition";
+        case Method::Diagonalization : return "diagonalization";
+        default : return "squaring + Schur (ill-conditioned eigenvectors)";
+    }
+}
+
+MatrixDouble PowerCache::operator ()(double n) const{
+    if(method_ == Method::Squaring){
+        MatrixDouble result;
+        matrix_power->compute(result, n);
+        return result;
+    }
+    Eigen::VectorXcd eigenvalues_n(eigenvalues.size());
+    for(int i = 0; i < eigenvalues.size(); i++){
+        eigenvalues_n(i) = pow(eigenvalues(i), n);
+    }
+    return ((V * eigenvalues_n.asDiagonal()) * V_inverse).real();
+}
+
+/*
+    Stationary distribution of a Markov chain.
+    For a transition matrix P (sum of each row = 1), computing P^1000 or P^10000 is only a way to see the limit of pi_0 P^n, 
+        that is the stationary distribution pi, such that pi P = pi, i.e. (I - P^T) pi^T = 0, with sum(pi) = 1.
+    Three methods that stop as soon as the result is accurate enough :
+        - steady_state_power : pi_(k+1) = pi_k P until |pi_(k+1) - pi_k| < tolerance (sum of absolute values). 
+          The difference is multiplied by about |lambda_2| at each step (lambda_2 = second largest eigenvalue in modulus), 
+          so the ratio of two successive differences estimates |lambda_2|, and the spectral gap 1 - |lambda_2| tells how fast the chain mixes ;
+        - steady_state_lu : direct solve of (I - P^T) pi^T = 0 with the sparse LU decomposition. The system is singular, 
+          so the last state gets the value pi_(N-1) = 1 : its column goes to the right-hand side and its equation is removed, 
+          which leaves an invertible system of size N-1 when the chain has a single stationary distribution. pi is normalized at the end ;
+        - steady_state_gmres : same system, solved with the iterative GMRES method (unsupported module IterativeSolvers) 
+          and the default (diagonal) preconditioner, for chains too large for the LU decomposition.
+*/
+struct SteadyStateResult{
+    Eigen::VectorXd pi;
+    bool converged;
+    long nb_iterations;
+    double residual; // |pi P - pi| (sum of absolute values)
+    double second_eigenvalue_modulus; // Estimate of |lambda_2| (power iteration only)
+};
+
+template <class MatrixType>
+    double stationary_residual(const MatrixType & P, const Eigen::VectorXd & pi){
+        Eigen::VectorXd pi_P = P.transpose() * pi;
+        return (pi_P - pi).lpNorm<1>();
+    }
+
+template <class MatrixType>
+    SteadyStateResult steady_state_power(const MatrixType & P, double tolerance = 1e-12, long max_iterations = 1000000){
+        SteadyStateResult result{Eigen::VectorXd::Constant(P.rows(), 1. / P.rows()), false, 0, 0., 0.};
+        Eigen::VectorXd next(P.rows());
+        double previous_difference = 0;
+        for(long k = 1; k <= max_iterations; k++){
+            next.noalias() = P.transpose() * result.pi;
+            double difference = (next - result.pi).lpNorm<1>();
+            result.pi.swap(next);
+            if(previous_difference > 0){
+                result.second_eigenvalue_modulus = difference / previous_difference;
+            }
+            previous_difference = difference;
+            result.nb_iterations = k;
+            if(difference < tolerance){
+                result.converged = true;
+                break;
+            }
+        }
+        result.pi /= result.pi.sum();
+        result.residual = stationary_residual(P, result.pi);
+        return result;
+    }
+
+/*
+    Rows and columns 0, ..., N-2 of I - P^T, and right-hand side = column N-1 of P^T (i.e. row N-1 of P) without its last coefficient.
+*/
+pair<SparseMatrix,Eigen::VectorXd> stationary_system(const SparseMatrix & P){
+    long N = P.rows();
+    vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(P.nonZeros() + N);
+    Eigen::VectorXd right_hand_side = Eigen::VectorXd::Zero(N - 1);
+    for(int j = 0; j < P.outerSize(); j++){
+        for(SparseMatrix::InnerIterator it(P, j); it; ++it){ // P(i,j) is the coefficient (j,i) of P^T
+            if(it.col() == N - 1) continue;
+            if(it.row() == N - 1) right_hand_side(it.col()) += it.value();
+            else triplets.emplace_back(it.col(), it.row(), -it.value());
+        }
+    }
+    for(long i = 0; i < N - 1; i++){
+        triplets.emplace_back(i, i, 1.);
+    }
+    SparseMatrix system(N - 1, N - 1);
+    system.setFromTriplets(triplets.begin(), triplets.end());
+    return {system, right_hand_side};
+}
+
+Eigen::VectorXd normalized_distribution(const Eigen::VectorXd & x){
+    Eigen::VectorXd pi(x.size() + 1);
+    pi << x, 1.;
+    return pi / pi.sum();
+}
+
+SteadyStateResult steady_state_lu(const SparseMatrix & P){
+    auto [system, right_hand_side] = stationary_system(P);
+    Eigen::SparseLU<SparseMatrix> Solver;
+    Solver.compute(system);
+    SteadyStateResult result{Eigen::VectorXd(), Solver.info() == Eigen::Success, 1, 0., 0.};
+    if(result.converged){
+        result.pi = normalized_distribution(Solver.solve(right_hand_side));
+        result.residual = stationary_residual(P, result.pi);
+    }
+    return result;
+}
+
+SteadyStateResult steady_state_gmres(const SparseMatrix & P, double tolerance = 1e-12){
+    auto [system, right_hand_side] = stationary_system(P);
+    Eigen::GMRES<SparseMatrix> Solver;
+    Solver.setTolerance(tolerance);
+    Solver.compute(system);
+    SteadyStateResult result{Eigen::VectorXd(), false, 0, 0., 0.};
+    if(Solver.info() == Eigen::Success){
+        result.pi = normalized_distribution(Solver.solve(right_hand_side));
+        result.converged = Solver.info() == Eigen::Success;
+        result.nb_iterations = Solver.iterations();
+        result.residual = stationary_residual(P, result.pi);
+    }
+    return result;
+}
+
+void print_steady_state(ostream & out, const string & method, const SteadyStateResult & result, double time){
+    out << "  " << method << " : " << (result.converged ? "converged" : "not converged") << " after " << result.nb_iterations 
+        << " iteration(s), residual " << result.residual;
+    if(result.second_eigenvalue_modulus > 0){
+        out << ", |lambda_2| ~ " << result.second_eigenvalue_modulus << " (spectral gap " << 1. - result.second_eigenvalue_modulus << ")";
+    }
+    out << ", " << time << " s\n";
+}
+
 template <class MatrixType,class FUNC> 
     double measure_time(FUNC func, const MatrixType & M,long unsigned power) {
         chrono::duration<double> computation_time;
         auto start = timer::now();
         auto result = func(M, power);
+        do_not_optimize(result);
         auto end = timer::now();
         computation_time = end - start;
         return computation_time.count();
@@ -47,36 +1268,343 @@ template <class MatrixType,class FUNC>
     instead of 
             template <class MatrixType> double measure_time(auto func, const MatrixType & M,long unsigned power) !
 */
-int main(){
-    const int size_of_matrix = 30;
-    
-    //Dense
-    MatrixDouble B(size_of_matrix,size_of_matrix);
-    ifstream input_1("matrice.txt");
-    for(int i = 0; i < size_of_matrix; i++){
-        for(int j = 0; j < size_of_matrix; j++){
-            input_1 >> B(i,j);
+/*
+    Benchmark of the power functions (see Benchmark.h) for several sizes, exponents and densities : 
+        ./Sec2_TemplateFunction --benchmark results.json    (or results.csv)
+    Number of products of fast_power for the exponent n : floor(log2(n)) squarings + (number of bits equal to 1) - 1 multiplications.
+    Each dense product of N x N matrices costs 2 N^3 operations and reads/writes 3 N^2 doubles.
+*/
+double nb_products(uint64_t n){
+    return floor(log2(double(n))) + __builtin_popcountll(n) - 1;
+}
+
+/*
+    Single precision.
+    fast_power only depends on the type of the matrix, so fast_power(MatrixFloat) computes the power in float : 
+        half the memory, and twice as many numbers in each SIMD register for the products (about 2 times faster for large matrices).
+    The precision of a float is about 1e-7, and each product adds its rounding errors : power_precision_report compares 
+        the float power with the double one (relative error in Frobenius norm) and gives the time of both. 
+        For a transition matrix we also look at the sums of the rows, which should stay equal to 1.
+    There is no cheap way to refine a power computed in float (the error of each squaring is propagated by the following ones), 
+        so the mixed precision version (float for the expensive part, double for the refinement) is only in Sec4, for the spectra.
+*/
+void power_precision_report(const string & name, const MatrixDouble & M, const vector<uint64_t> & exponents){
+    MatrixFloat M_float = M.cast<float>();
+    for(uint64_t n : exponents){
+        auto start = timer::now();
+        MatrixDouble P_double = fast_power(M, n);
+        chrono::duration<double> double_time = timer::now() - start;
+        start = timer::now();
+        MatrixFloat P_float = fast_power(M_float, n);
+        chrono::duration<double> float_time = timer::now() - start;
+        double error = (P_float.cast<double>() - P_double).norm() / P_double.norm();
+        double row_sum_error = (P_float.cast<double>().rowwise().sum().array() - 1.).abs().maxCoeff();
+        cout << name << "^" << n << " : double " << double_time.count() << " s, float " << float_time.count() 
+             << " s, relative error of the float power " << error << ", largest |row sum - 1| " << row_sum_error << "\n";
+    }
+}
+
+/*
+    The dense products of fast_power are timed with each available backend, with the number of threads chosen by --threads. 
+    The backend is written in the parameters of each result (for example "backend=blocked (4 threads)").
+*/
+void run_power_benchmarks(const string & filename){
+    BenchmarkReport report;
+    const ProductSettings selected = product_settings();
+    vector<ProductBackend> backends;
+    for(ProductBackend backend : {ProductBackend::Eigen, ProductBackend::Blas, ProductBackend::Blocked}){
+        if(product_backend_available(backend)) backends.push_back(backend);
+    }
+    for(int N : {30, 100, 300}){
+        MatrixDouble P = MatrixDouble(random_transition_matrix(N, N / 2, 1));
+        MatrixFloat P_float = P.cast<float>();
+        for(uint64_t n : {100, 1000, 10000}){
+            double products = nb_products(n);
+            for(ProductBackend backend : backends){
+                set_product_backend(backend, selected.nb_threads);
+                string parameters = "N=" + to_string(N) + " n=" + to_string(n) + " backend=" + product_backend_name();
+                report.add(run_benchmark("fast_power dense", parameters, 
+                                         [&](){return fast_power(P, n);}, products * 2. * N * N * N, products * 3. * N * N * sizeof(double)));
+                report.add(run_benchmark("fast_power dense float", parameters, 
+                                         [&](){return fast_power(P_float, n);}, products * 2. * N * N * N, products * 3. * N * N * sizeof(float)));
+            }
         }
     }
-    input_1.close();
-    
-    // Sparse
-    SparseMatrix C(size_of_matrix,size_of_matrix);
-    ifstream input_2("matrice.txt");
-    for (int i = 0; i < size_of_matrix ; i++){
-       for (int j = 0; j < size_of_matrix ; j++){
-        double v;
-        input_2 >> v;
-        if (std::abs(v)> 1e-12)
-            C.coeffRef(i,j) = v;
+    set_product_backend(selected.backend, selected.nb_threads);
+    for(int nb_per_row : {1, 2, 4}){
+        SparseMatrix P = random_transition_matrix(300, nb_per_row, 2);
+        string parameters = "N=300 n=1000 density=" + to_string(P.nonZeros() / (300. * 300.));
+        report.add(run_benchmark("fast_power sparse", parameters, [&](){return fast_power(P, 1000);}));
+        SparsePowerOptions options;
+        report.add(run_benchmark("sparse_power_adaptive", parameters, [&](){
+            vector<SparsePowerStep> steps;
+            return sparse_power_adaptive(P, 1000, options, steps).nb_non_zeros();
+        }));
+    }
+    SparseMatrix P = random_transition_matrix(100000, 4, 3);
+    for(int k : {1, 4}){
+        MatrixDouble X = MatrixDouble::Constant(k, P.rows(), 1. / P.rows());
+        double nb_steps = 100;
+        report.add(run_benchmark("vectors_times_power sparse", "N=100000 nnz=" + to_string(P.nonZeros()) + " n=100 k=" + to_string(k), 
+                                 [&](){return vectors_times_power(X, P, 100);}, nb_steps * 2. * P.nonZeros() * k, 
+                                 nb_steps * (P.nonZeros() * (sizeof(double) + sizeof(int)) + 2. * P.rows() * k * sizeof(double)), 1, 5));
+    }
+    save_benchmark_report(report, filename);
+}
+
+/*
+    The backends must give the same products, up to the rounding errors (the sums are not made in the same order) : 
+        we compare them with Eigen on sizes that are not multiples of the blocks, then on a power of a transition matrix.
+*/
+bool check_product_backends(){
+    const ProductSettings selected = product_settings();
+    bool ok = true;
+    mt19937 G(7);
+    uniform_real_distribution<double> U(-1., 1.);
+    for(auto [m, n, k] : {array<int,3>{1, 1, 1}, array<int,3>{7, 3, 5}, array<int,3>{37, 53, 29}, array<int,3>{200, 130, 301}, array<int,3>{300, 300, 300}}){
+        MatrixDouble A = MatrixDouble::NullaryExpr(m, k, [&](){return U(G);});
+        MatrixDouble B = MatrixDouble::NullaryExpr(k, n, [&](){return U(G);});
+        MatrixDouble reference = A * B;
+        MatrixFloat reference_float = (A.cast<float>() * B.cast<float>()).eval();
+        for(ProductBackend backend : {ProductBackend::Blas, ProductBackend::Blocked}){
+            if(!product_backend_available(backend)) continue;
+            set_product_backend(backend, max(2, selected.nb_threads));
+            MatrixDouble C;
+            dense_product(C, A, B);
+            MatrixFloat C_float;
+            dense_product(C_float, MatrixFloat(A.cast<float>()), MatrixFloat(B.cast<float>()));
+            double error = (C - reference).cwiseAbs().maxCoeff();
+            double error_float = (C_float - reference_float).cwiseAbs().maxCoeff();
+            if(error > 1e-12 * k || error_float > 1e-5 * k){
+                cout << "Product " << m << " x " << k << " times " << k << " x " << n << " with " << product_backend_name() 
+                     << " : error " << error << " (float " << error_float << ")\n";
+                ok = false;
+            }
+        }
+    }
+    set_product_backend(ProductBackend::Eigen);
+    MatrixDouble P = MatrixDouble(random_transition_matrix(300, 150, 4));
+    MatrixDouble reference = fast_power(P, 1000);
+    for(ProductBackend backend : {ProductBackend::Blas, ProductBackend::Blocked}){
+        if(!product_backend_available(backend)) continue;
+        set_product_backend(backend, selected.nb_threads);
+        auto start = timer::now();
+        MatrixDouble Q = fast_power(P, 1000);
+        chrono::duration<double> time = timer::now() - start;
+        double error = (Q - reference).norm() / reference.norm();
+        cout << "P^1000 (300 x 300) with the backend " << product_backend_name() << " : " << time.count() 
+             << " s, relative difference with Eigen " << error << "\n";
+        ok = ok && error < 1e-12;
+    }
+    set_product_backend(selected.backend, selected.nb_threads);
+    cout << "Product backends " << (ok ? "agree with Eigen" : "DIFFER FROM EIGEN") << "\n";
+    return ok;
+}
+
+int main(int argc, char ** argv){
+    // Options : --backend eigen|blas|blocked, --threads n, --benchmark file
+    string benchmark_file;
+    ProductBackend backend = ProductBackend::Eigen;
+    int nb_threads = max(1u, thread::hardware_concurrency());
+    try{
+        for(int k = 1; k < argc; k++){
+            string option = argv[k];
+            if(option == "--backend" && k + 1 < argc){
+                backend = parse_product_backend(argv[++k]);
+            }
+            else if(option == "--threads" && k + 1 < argc){
+                string value = argv[++k];
+                auto [next, error] = from_chars(value.data(), value.data() + value.size(), nb_threads);
+                if(error != errc() || next != value.data() + value.size() || nb_threads < 1){
+                    throw runtime_error("--threads needs a positive integer, not " + value);
+                }
+            }
+            else if(option == "--benchmark" && k + 1 < argc){
+                benchmark_file = argv[++k];
+            }
+            else{
+                throw runtime_error("Unknown option " + option);
+            }
         }
+        set_product_backend(backend, nb_threads);
+    }
+    catch(const exception & e){
+        cout << e.what() << "\n";
+        cout << "Usage : " << argv[0] << " [--backend eigen|blas|blocked] [--threads n] [--benchmark file]\n";
+        return 1;
+    }
+    cout << "Dense products : " << product_backend_name() << "\n";
+    if(!benchmark_file.empty()){
+        run_power_benchmarks(benchmark_file);
+        return 0;
+    }
+    if(!check_product_backends()){
+        return 1;
+    }
+
+    // The size of the matrix is found in the file
+    MatrixDouble B = load_dense_text("matrice.txt"); // Dense
+    SparseMatrix C = load_sparse_text("matrice.txt"); // Sparse
+    cout << "Matrix of size " << B.rows() << " x " << B.cols() << " with " << C.nonZeros() << " non-zero coefficients\n";
+
+    // The other formats give the same matrices
+    save_matrix_market("matrice.mtx",C);
+    save_binary("matrice.bin",B);
+    save_binary("matrice_sparse.bin",C);
+    {
+        SparseMatrix C_mtx = load_matrix_market("matrice.mtx");
+        MappedMatrix B_bin("matrice.bin");
+        MappedSparseMatrix C_bin("matrice_sparse.bin");
+        cout << "Matrix Market : " << ((MatrixDouble(C_mtx) - B).norm() == 0 ? "same matrix" : "different matrix") << ", "
+             << "binary : " << ((B_bin.matrix() - B).norm() == 0 ? "same matrix" : "different matrix") << ", "
+             << "sparse binary : " << (C_bin.matrix().nonZeros() == C.nonZeros() && (SparseMatrix(C_bin.matrix()) - C).norm() == 0 ? "same matrix" : "different matrix") << "\n";
     }
-    input_2.close();
 
     double time_fast_power = measure_time(fast_power<MatrixDouble>,B,1000);
     cout << "Time taken to compute B^1000 using the second method = " << time_fast_power << " s \n";
     double time_sparse_power = measure_time(fast_power<SparseMatrix>,C,1000);
     cout << "Time taken to compute B^1000 in sparse format = " << time_sparse_power << " s" << std::endl;
 
+    // Sparse power with the report of the fill-in
+    {
+        SparsePowerOptions options;
+        vector<SparsePowerStep> report;
+        AdaptiveMatrix C_1000 = sparse_power_adaptive(C, 1000, options, report);
+        cout << "C^1000 with sparse_power_adaptive (same result : " << ((C_1000.to_dense() - MatrixDouble(fast_power(C, 1000))).norm() == 0 ? "yes" : "no") << ")\n";
+        print_sparse_power_report(cout, report);
+
+        SparseMatrix P = random_transition_matrix(500, 4, 42);
+        report.clear();
+        AdaptiveMatrix P_1000 = sparse_power_adaptive(P, 1000, options, report);
+        cout << "P^1000 for a random 500 x 500 transition matrix with 4 non-zeros per row :\n";
+        print_sparse_power_report(cout, report);
+    }
+
+    // Many powers of a small matrix : the buffers are reused from one call to the next
+    MatrixDouble A(3,3);
+    A << 0.4, 0.6, 0,
+        0.75, 0.25, 0,
+        0, 0, 1;
+    const int nb_calls = 100000;
+    PowerBuffers<MatrixDouble> buffers;
+    double checksum = 0;
+    auto start = timer::now();
+    for(int k = 0; k < nb_calls; k++){
+        checksum += fast_power_with_buffers(A, 1000 + k % 64, buffers)(0,0);
+    }
+    chrono::duration<double> time_with_buffers = timer::now() - start;
+    start = timer::now();
+    for(int k = 0; k < nb_calls; k++){
+        checksum += fast_power(A, 1000 + k % 64)(0,0);
+    }
+    chrono::duration<double> time_without_buffers = timer::now() - start;
+    // (fast_power sees that A is 3 x 3 and uses the fixed-size version)
+    cout << nb_calls << " powers of a 3 x 3 matrix : " << time_with_buffers.count() << " s with dynamic size and reused buffers, " 
+         << time_without_buffers.count() << " s with fast_power (checksum " << checksum << ")\n";
+
+    // Distribution of a Markov chain after n steps, without computing P^n
+    {
+        MatrixDouble pi_0 = MatrixDouble::Zero(1, 3);
+        pi_0(0, 0) = 1.;
+        cout << "pi_0 A^1000 = " << vectors_times_power(pi_0, A, 1000) << " (A^1000 computed with squaring)\n";
+
+        const int nb_states = 100000;
+        const int nb_steps = 100;
+        SparseMatrix P = random_transition_matrix(nb_states, 4, 7);
+        MatrixDouble pi(4, nb_states); // 4 initial distributions, each one concentrated on one state
+        pi.setZero();
+        for(int k = 0; k < 4; k++){
+            pi(k, k * (nb_states / 4)) = 1.;
+        }
+        auto start = timer::now();
+        MatrixDouble pi_n = vectors_times_power(pi, P, nb_steps);
+        chrono::duration<double> time = timer::now() - start;
+        cout << "4 distributions after " << nb_steps << " steps of a chain with " << nb_states << " states : " << time.count() 
+             << " s (sums of the rows : " << pi_n.rowwise().sum().transpose() << ")\n";
+    }
+
+    // Stationary distributions instead of high powers
+    {
+        // A has two closed classes ({0, 1} and {2}), so its stationary distribution is not unique : 
+        // the power iteration gives the limit when starting from the uniform distribution (the LU system would be singular).
+        SteadyStateResult A_steady = steady_state_power(A);
+        cout << "Stationary distribution of A : " << A_steady.pi.transpose() << "\n";
+        print_steady_state(cout, "power iteration", A_steady, 0.);
+
+        for(int nb_states : {2000, 100000}){
+            SparseMatrix P = random_transition_matrix(nb_states, 4, 11);
+            cout << "Random chain with " << nb_states << " states :\n";
+            auto start = timer::now();
+            SteadyStateResult power_result = steady_state_power(P, 1e-10);
+            chrono::duration<double> time = timer::now() - start;
+            print_steady_state(cout, "power iteration", power_result, time.count());
+            start = timer::now();
+            SteadyStateResult gmres_result = steady_state_gmres(P, 1e-10);
+            time = timer::now() - start;
+            print_steady_state(cout, "GMRES", gmres_result, time.count());
+            if(nb_states <= 2000){
+                start = timer::now();
+                SteadyStateResult lu_result = steady_state_lu(P);
+                time = timer::now() - start;
+                print_steady_state(cout, "sparse LU", lu_result, time.count());
+            }
+        }
+    }
+
+    // Many exponents of the same matrix
+    {
+        PowerCache A_powers(A);
+        PowerCache B_powers(B);
+        cout << "PowerCache of A : " << A_powers.method_name() << " (condition number " << A_powers.condition_number() << ")\n";
+        cout << "PowerCache of B : " << B_powers.method_name() << " (condition number " << B_powers.condition_number() << ")\n";
+        for(uint64_t n : {100, 1000, 10000}){
+            cout << "  n = " << n << " : |A^n - fast_power| = " << (A_powers(n) - fast_power(A, n)).norm() 
+                 << ", |B^n - fast_power| = " << (B_powers(n) - fast_power(B, n)).norm() << "\n";
+        }
+        // A has a negative eigenvalue, so A^0.5 is not real : we take A^2, whose eigenvalues are all positive
+        MatrixDouble A2 = A * A;
+        PowerCache A2_powers(A2);
+        MatrixDouble A2_half = A2_powers(0.5);
+        cout << "  |(A^2)^0.5 * (A^2)^0.5 - A^2| = " << (A2_half * A2_half - A2).norm() << "\n";
+        // A Jordan block is not diagonalizable (squaring + Schur) : the cache must still work after a move and a move assignment
+        MatrixDouble J{{0.5, 1., 0.}, {0., 0.5, 1.}, {0., 0., 0.5}};
+        PowerCache J_powers(J);
+        PowerCache J_moved(move(J_powers));
+        PowerCache J_assigned(MatrixDouble::Identity(3,3));
+        J_assigned = move(J_moved);
+        double J_error = (J_assigned(20) - fast_power(J, 20)).norm();
+        cout << "  Jordan block (" << J_assigned.method_name() << ") after a move : |J^20 - fast_power| = " << J_error << "\n";
+        if(J_assigned.method() != PowerCache::Method::Squaring || J_error > 1e-10){
+            cout << "PowerCache is wrong after a move\n";
+            return 1;
+        }
+    }
+
+    // Same computations with a fixed-size matrix
+    using Matrix3 = Eigen::Matrix<double,3,3>;
+    Matrix3 A_fixed = A;
+    PowerBuffers<Matrix3> fixed_buffers;
+    start = timer::now();
+    for(int k = 0; k < nb_calls; k++){
+        checksum += fast_power_with_buffers(A_fixed, 1000 + k % 64, fixed_buffers)(0,0);
+    }
+    chrono::duration<double> time_fixed_size = timer::now() - start;
+    start = timer::now();
+    for(int k = 0; k < nb_calls; k++){
+        checksum += fast_power_fixed_exponent<1000>(A_fixed)(0,0);
+    }
+    chrono::duration<double> time_fixed_exponent = timer::now() - start;
+    cout << nb_calls << " powers of a fixed-size 3 x 3 matrix : " << time_fixed_size.count() << " s, " 
+         << time_fixed_exponent.count() << " s with the exponent 1000 known at compile time (checksum " << checksum << ")\n";
+
+    // Float instead of double
+    power_precision_report("transition matrix 500 x 500", MatrixDouble(random_transition_matrix(500, 250, 5)), {10, 100, 1000});
+
+    /* 
+    The exponent can be as large as 2^64 - 1 (no recursion, only 2*64 products). 
+    But be careful : each squaring doubles the rounding errors, so for n close to 2^63 the result is no longer accurate.
+    */
+    cout << "A^(10^12) =\n" << fast_power(A, uint64_t(1000000000000)) << "\n";
+
     return 0;
 }
\ No newline at end of file
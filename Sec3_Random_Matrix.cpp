@@ -10,7 +10,7 @@
 
 
 using namespace std;
-using timer = std::chrono::system_clock;
+using timer = std::chrono::steady_clock;
 using MatrixDouble = Eigen::Matrix <double, Eigen::Dynamic, Eigen::Dynamic>;
 using SparseMatrix = Eigen::SparseMatrix<double>;
 
@@ -60,10 +60,12 @@ int main(){
     vector<double> hist(nb_boxes,0); // This is the vector that will contain the number of eigenvalues that fall into each subinterval of [a, b].
     chrono::duration<double> process;
     auto start = timer::now();
+    MatrixDouble RandomMat(matrixsize,matrixsize); // Allocated once, every sample overwrites all its coefficients
+    normal_distribution<double> diagonal_distribution(0,1); // Diagonal elements distribution
+    normal_distribution<double> off_diagonal_distribution(0,2); // Off-diagonal elements distribution
+    const double normalization = 1. / (2.*sqrt(matrixsize)); // Computed once, not for every eigenvalue
+    const double inverse_width = nb_boxes / (b-a); // A multiplication is much faster than a division
     for(int sample = 0; sample < simul; sample++){
-        MatrixDouble RandomMat(matrixsize,matrixsize);
-        normal_distribution<double> diagonal_distribution(0,1); // Diagonal elements distribution
-        normal_distribution<double> off_diagonal_distribution(0,2); // Off-diagonal elements distribution
         for(int i = 0; i < matrixsize; i++){
             RandomMat(i,i) = diagonal_distribution(G);
             for(int j = 0; j < matrixsize; j++){
@@ -79,13 +81,16 @@ int main(){
                 */
             }
         }
-        Eigen::EigenSolver<MatrixDouble> Solver(RandomMat); // Eigen vector
+        Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver(RandomMat,Eigen::EigenvaluesOnly); // Eigen vector
+        /* RandomMat is symmetric : SelfAdjointEigenSolver (tridiagonal reduction + symmetric QR) is much faster 
+        * than EigenSolver and directly gives real eigenvalues.
+        */
         for(int i = 0; i < matrixsize; i++){
-            double lambda_normalized = Solver.eigenvalues()[i].real() / (2.*sqrt(matrixsize));
+            double lambda_normalized = Solver.eigenvalues()[i] * normalization;
             /* The documentation states that diagonalization is performed during the construction of Solver:
             * eigenvalues() is just an accessor to the computation, and the eigenvalues are not calculated each time.
             */
-            int index = std::floor( (lambda_normalized-a)/(b-a)*nb_boxes);
+            int index = std::floor( (lambda_normalized-a)*inverse_width);
             /*
             * This formula, in the case of subdividing an interval, exactly determines if an eigenvalue is within the correct segment. 
             * With a small modification, we can obtain an index that will represent a slot in the hist vector, 
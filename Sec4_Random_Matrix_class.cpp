@@ -6,25 +6,63 @@
 #include <random>
 #include <fstream>
 #include <algorithm>
+#include <numeric>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cmath>
+#include <functional>
+#include <unordered_set>
+#include <csignal>
+#include <cstdio>
+#include <sstream>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Benchmark.h"
+#include "Instrumentation.h"
 
 using namespace std;
-using timer = std::chrono::system_clock;
+using timer = std::chrono::steady_clock;
 using MatrixDouble = Eigen::Matrix <double, Eigen::Dynamic, Eigen::Dynamic>;
 using SparseMatrix = Eigen::SparseMatrix<double>;
 using MT = std::mt19937;
+
+/*
+    Phases of a sample, for the instrumentation (Instrumentation.h, compile with -DINSTRUMENTATION to enable it).
+    The eigenvalues are binned a whole sample at a time with Histogram::insert (in the parallel driver : in a local histogram, 
+        then merged into the shared one), and each value only takes a few nanoseconds : the phase "binning" is the insert 
+        (and the merge) of a whole sample, not of a single value.
+*/
+enum SpectrumPhase {Generation, Reduction, Iterations, Binning};
+const vector<string> spectrum_phase_names = {"generation", "reduction to tridiagonal form", "QR iterations", "binning"};
+
+/*
+    Allocation counter (only with -DCOUNT_ALLOCATIONS, and only with the GNU C library).
+    Eigen allocates its matrices with malloc and the standard containers go through operator new, which also calls malloc : 
+        by replacing malloc, calloc and realloc with functions that count the calls before calling the real ones of the glibc, 
+        we see every heap allocation of the program. It is used at the end of main to check SpectrumWorkspace.
+*/
+#if defined(COUNT_ALLOCATIONS) && defined(__GLIBC__)
+atomic<long> nb_allocations(0);
+extern "C" {
+    void * __libc_malloc(size_t size);
+    void * __libc_calloc(size_t nb, size_t size);
+    void * __libc_realloc(void * ptr, size_t size);
+    void * malloc(size_t size){ nb_allocations.fetch_add(1,memory_order_relaxed); return __libc_malloc(size); }
+    void * calloc(size_t nb, size_t size){ nb_allocations.fetch_add(1,memory_order_relaxed); return __libc_calloc(nb,size); }
+    void * realloc(void * ptr, size_t size){ nb_allocations.fetch_add(1,memory_order_relaxed); return __libc_realloc(ptr,size); }
+}
+#endif
 /*
 Here, I am trying to do the same thing by using a function that generates random matrices, 
     along with a histogram class that helps us organize things and write clean code.
 */
 
-auto generate_random_spectrum(MT & G,int matrixsize){
-    MatrixDouble RandomMat(matrixsize,matrixsize);
-    static normal_distribution<double> diagonal_distribution(0,1);
-    static normal_distribution<double> off_diagonal_distribution(0,2);
-    /*
-    Using static for distributions is beneficial because it reduces the overhead of reinitializing 
-            the distributions at each function call while ensuring that the distribution remains the same between calls.
-    */
+template <class MatrixType>
+void fill_random_matrix(MT & G, MatrixType & RandomMat, 
+                        normal_distribution<double> & diagonal_distribution, normal_distribution<double> & off_diagonal_distribution){
+    int matrixsize = RandomMat.rows();
     for(int i = 0; i < matrixsize; i++){
         RandomMat(i,i) = diagonal_distribution(G);
         for(int j = i + 1; j < matrixsize; j++){
@@ -33,31 +71,587 @@ auto generate_random_spectrum(MT & G,int matrixsize){
             RandomMat(j,i) = off_diag_value; 
         }
     }
+}
+
+void fill_random_matrix(MT & G, MatrixDouble & RandomMat){
+    normal_distribution<double> diagonal_distribution(0,1);
+    normal_distribution<double> off_diagonal_distribution(0,2);
+    /*
+    The distributions used to be static to avoid reinitializing them at each call. 
+    But a normal_distribution has an internal state (it keeps the second value produced by its algorithm), 
+            so a static one is shared by all the threads that call this function, which is a data race. 
+    Building them is only storing two doubles, so local distributions cost nothing compared to the diagonalization.
+    To keep them from one sample to the next, use SpectrumWorkspace below.
+    */
+    fill_random_matrix(G,RandomMat,diagonal_distribution,off_diagonal_distribution);
+}
+
+/*
+    Fast generation of the matrix.
+    std::mt19937 + normal_distribution gives one number at a time, and fill_random_matrix writes each value twice, 
+        the second time in RandomMat(j,i) which jumps from one column to the next (the matrix is stored column by column).
+    
+    1/ Xoshiro256 is the xoshiro256+ generator of Blackman and Vigna : 4 integers of state, a few shifts and xors per number, 
+       and its 53 high bits give a good double in [0,1). jump() advances the generator by 2^128 steps, 
+       which gives independent streams for the threads from a single seed.
+    2/ fill_normals makes the normal numbers by blocks with the Box-Muller transform : first all the uniform numbers, 
+       then the transform (log, sqrt, cos, sin) on the whole block in a loop without dependencies between iterations. 
+       The generator is no longer called in the middle of the computations, and the loop can be vectorized by compilers 
+       that have a vector version of log, cos and sin.
+    3/ SelfAdjointEigenSolver only reads the lower triangular part of the matrix, so fill_random_lower_triangle only fills it, 
+       column by column : the part of column j under the diagonal is contiguous in memory and is written directly by fill_normals.
+       The upper triangular part is not used (not even initialized) : this matrix must only be given to the symmetric solver.
+*/
+class Xoshiro256{
+    private :
+        uint64_t state[4];
+        static uint64_t rotl(uint64_t x, int k) {return (x << k) | (x >> (64 - k));}
+    public :
+        using result_type = uint64_t;
+        explicit Xoshiro256(uint64_t seed); // constructor
+        static constexpr result_type min() {return 0;}
+        static constexpr result_type max() {return UINT64_MAX;}
+        result_type operator ()(); // Next 64 bits number, so that it can also be used with the distributions of <random>
+        double uniform() {return ((*this)() >> 11) * 0x1.0p-53;} // Uniform in [0,1)
+        float uniform_float() {return ((*this)() >> 40) * 0x1.0p-24f;} // Uniform in [0,1), 24 bits (precision of a float)
+        void jump(); // Same as 2^128 calls to operator ()
+        void write(ostream & out) const {out.write(reinterpret_cast<const char *>(state),sizeof(state));} // Binary state, for the checkpoints
+        void read(istream & in) {in.read(reinterpret_cast<char *>(state),sizeof(state));}
+};
+
+/*
+    The 4 integers of the state are filled with the splitmix64 generator, as recommended by the authors 
+        (the state must not be zero everywhere, and close seeds must give very different states).
+*/
+Xoshiro256::Xoshiro256(uint64_t seed){
+    for(auto & x : state){
+        seed += 0x9e3779b97f4a7c15;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        x = z ^ (z >> 31);
+    }
+}
+
+Xoshiro256::result_type Xoshiro256::operator ()(){
+    uint64_t result = state[0] + state[3];
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3],45);
+    return result;
+}
+
+void Xoshiro256::jump(){
+    static const uint64_t JUMP[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c, 0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+    uint64_t s[4] = {0,0,0,0};
+    for(uint64_t jump_word : JUMP){
+        for(int bit = 0; bit < 64; bit++){
+            if(jump_word & (uint64_t(1) << bit)){
+                for(int k = 0; k < 4; k++){
+                    s[k] ^= state[k];
+                }
+            }
+            (*this)();
+        }
+    }
+    for(int k = 0; k < 4; k++){
+        state[k] = s[k];
+    }
+}
+
+/*
+    Writes count independent N(0, stddev^2) numbers in out[0], ..., out[count-1].
+    Box-Muller : if u1 in (0,1] and u2 in [0,1) are uniform, r*cos(2*pi*u2) and r*sin(2*pi*u2) with r = sqrt(-2 log(u1)) 
+        are two independent N(0,1) numbers. The cosines go in the first half of the block and the sines in the second half, 
+        so that both loops read and write contiguous memory. If count is odd, the last sine is not used.
+*/
+template <class Scalar>
+void fill_normals(Xoshiro256 & G, Scalar * out, int count, Scalar stddev){
+    const Scalar two_pi = 2. * M_PI;
+    auto uniform = [&]() -> Scalar { // In float, the transform uses logf, cosf and sinf, which are faster
+        if constexpr (is_same_v<Scalar,float>) return G.uniform_float();
+        else return G.uniform();
+    };
+    int nb_pairs = count / 2;
+    Scalar * cosines = out;
+    Scalar * sines = out + nb_pairs;
+    for(int k = 0; k < nb_pairs; k++){
+        cosines[k] = Scalar(1) - uniform(); // in (0,1] : log(0) is avoided
+        sines[k] = uniform();
+    }
+    for(int k = 0; k < nb_pairs; k++){
+        Scalar r = stddev * sqrt(Scalar(-2) * log(cosines[k]));
+        Scalar theta = two_pi * sines[k];
+        cosines[k] = r * cos(theta);
+        sines[k] = r * sin(theta);
+    }
+    if(count % 2 == 1){
+        Scalar r = stddev * sqrt(Scalar(-2) * log(Scalar(1) - uniform()));
+        out[count - 1] = r * cos(two_pi * uniform());
+    }
+}
+
+/*
+    Same law as fill_random_matrix (N(0,1) on the diagonal, standard deviation 2 below), lower triangular part only.
+*/
+template <class MatrixType>
+void fill_random_lower_triangle(Xoshiro256 & G, MatrixType & RandomMat){
+    using Scalar = typename MatrixType::Scalar;
+    int matrixsize = RandomMat.rows();
+    for(int j = 0; j < matrixsize; j++){
+        fill_normals(G,&RandomMat(j,j),matrixsize - j,Scalar(2));
+        RandomMat(j,j) *= 0.5; // The diagonal has a standard deviation of 1
+    }
+}
+
+/*
+    First version : general (non symmetric) solver. 
+    EigenSolver does a Hessenberg reduction followed by a real Schur (QR) iteration and returns complex eigenvalues, 
+        whose imaginary part is always zero here since the matrix is symmetric. 
+    I keep it as the reference path for the comparison made in main.
+    EigenSolver does not give access to its two steps, so for the instrumentation the Hessenberg reduction 
+        is counted with the QR iterations (phase "QR iterations").
+*/
+auto generate_random_spectrum(MT & G,int matrixsize){
+    MatrixDouble RandomMat(matrixsize,matrixsize);
+    {
+        PHASE_TIMER(Generation);
+        fill_random_matrix(G,RandomMat);
+    }
+    PHASE_TIMER(Iterations);
     Eigen::EigenSolver<MatrixDouble> EigenVector(RandomMat);
     return EigenVector.eigenvalues();
 }
 
+/*
+    Second version : symmetric solver.
+    SelfAdjointEigenSolver only reads the lower triangular part, reduces it to a tridiagonal matrix (Householder) 
+        and then runs an implicit symmetric QR iteration on the tridiagonal matrix. 
+    No eigenvector (orthogonal matrix Q) is accumulated, and the eigenvalues are real and sorted.
+
+    Workspace for the symmetric version : it owns everything a sample needs (the matrix, the distributions, 
+        the solver and its internal buffers, the eigenvalues), all allocated once in the constructor. 
+    The two steps of SelfAdjointEigenSolver::compute are made separately, to be able to measure them : 
+        Householder reduction to a tridiagonal matrix (Eigen::Tridiagonalization, O(N^3)), 
+        then QR iterations on the tridiagonal matrix (computeFromTridiagonal, O(N^2)). 
+    Since the eigenvectors are not computed, the solver is built with its default constructor (no N x N matrix for them).
+    After the first call to sample (warm-up), a sample does not make any heap allocation.
+    A workspace is not shared : each thread must have its own.
+
+    Precision : the matrix and the reduction use Scalar, the tridiagonal matrix and the QR iterations use IterationScalar.
+        - BasicSpectrumWorkspace<double> (SpectrumWorkspace) : everything in double, as before ;
+        - BasicSpectrumWorkspace<float> : everything in float. A float takes 4 bytes instead of 8 : the matrix takes half the memory, 
+          and a SIMD register holds twice as many numbers, so the O(N^3) reduction is faster. The relative error on the eigenvalues 
+          is about 1e-7 instead of 1e-16, which is much smaller than the width of the bins, but the QR iterations also run in float ;
+        - BasicSpectrumWorkspace<float, double> (mixed precision) : the matrix and the reduction in float, then the tridiagonal matrix 
+          is converted to double and the QR iterations (or the Sturm counts) are made in double. The expensive part is computed in float, 
+          and only the O(N^2) part, where the eigenvalues are actually separated, is refined in double.
+    See precision_report for the errors and the times of the three versions.
+*/
+template <class Scalar, class IterationScalar = Scalar>
+class BasicSpectrumWorkspace{
+    public :
+        using Matrix = Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>;
+        using Vector = Eigen::Matrix<IterationScalar, Eigen::Dynamic, 1>;
+    private :
+        Matrix RandomMat;
+        normal_distribution<double> diagonal_distribution;
+        normal_distribution<double> off_diagonal_distribution;
+        Eigen::Tridiagonalization<Matrix> Tridiagonal;
+        Vector diag;
+        Vector subdiag;
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix<IterationScalar, Eigen::Dynamic, Eigen::Dynamic>> Solver;
+        Vector eigenvalues;
+        void reduce(); // Tridiagonal form of RandomMat (lower triangular part) in diag and subdiag
+        const Vector & compute_spectrum(); // Eigenvalues of RandomMat
+    public :
+        BasicSpectrumWorkspace(int matrixsize) : RandomMat(matrixsize,matrixsize), diagonal_distribution(0,1), off_diagonal_distribution(0,2), 
+                                                 Tridiagonal(matrixsize), diag(matrixsize), subdiag(matrixsize - 1), eigenvalues(matrixsize) {}; // constructor
+        int matrix_size() const {return this-> RandomMat.rows();}
+        const Vector & spectrum() const {return this-> eigenvalues;}
+        const Vector & sample(MT & G); // Draw a new matrix and return its (real, sorted) eigenvalues
+        const Vector & sample(Xoshiro256 & G); // Same with the fast generation of the lower triangular part
+        template <class Derived>
+            const Vector & spectrum_of(const Eigen::MatrixBase<Derived> & M){ // Eigenvalues of a given matrix (lower triangular part, converted to Scalar)
+                RandomMat.template triangularView<Eigen::Lower>() = M.template cast<Scalar>();
+                return compute_spectrum();
+            }
+        void sample_tridiagonal(Xoshiro256 & G); // Draw a new matrix and only reduce it to tridiagonal form (no QR iterations)
+        const Vector & tridiagonal_diagonal() const {return this-> diag;}
+        const Vector & tridiagonal_subdiagonal() const {return this-> subdiag;}
+};
+
+using SpectrumWorkspace = BasicSpectrumWorkspace<double>;
+
+template <class Scalar, class IterationScalar>
+void BasicSpectrumWorkspace<Scalar,IterationScalar>::reduce(){
+    PHASE_TIMER(Reduction);
+    Tridiagonal.compute(RandomMat);
+    diag = Tridiagonal.diagonal().template cast<IterationScalar>();
+    subdiag = Tridiagonal.subDiagonal().template cast<IterationScalar>();
+}
+
+template <class Scalar, class IterationScalar>
+const typename BasicSpectrumWorkspace<Scalar,IterationScalar>::Vector & BasicSpectrumWorkspace<Scalar,IterationScalar>::compute_spectrum(){
+    reduce();
+    {
+        PHASE_TIMER(Iterations);
+        Solver.computeFromTridiagonal(diag,subdiag,Eigen::EigenvaluesOnly);
+        eigenvalues = Solver.eigenvalues();
+    }
+    return eigenvalues;
+}
+
+template <class Scalar, class IterationScalar>
+const typename BasicSpectrumWorkspace<Scalar,IterationScalar>::Vector & BasicSpectrumWorkspace<Scalar,IterationScalar>::sample(MT & G){
+    {
+        PHASE_TIMER(Generation);
+        fill_random_matrix(G,RandomMat,diagonal_distribution,off_diagonal_distribution);
+    }
+    return compute_spectrum();
+}
+
+template <class Scalar, class IterationScalar>
+const typename BasicSpectrumWorkspace<Scalar,IterationScalar>::Vector & BasicSpectrumWorkspace<Scalar,IterationScalar>::sample(Xoshiro256 & G){
+    {
+        PHASE_TIMER(Generation);
+        fill_random_lower_triangle(G,RandomMat);
+    }
+    return compute_spectrum();
+}
+
+template <class Scalar, class IterationScalar>
+void BasicSpectrumWorkspace<Scalar,IterationScalar>::sample_tridiagonal(Xoshiro256 & G){
+    {
+        PHASE_TIMER(Generation);
+        fill_random_lower_triangle(G,RandomMat);
+    }
+    reduce();
+}
+
+/*
+    Third version : tridiagonal model of Dumitriu and Edelman (beta-Hermite ensemble).
+    The Householder reduction of a GOE matrix gives a symmetric tridiagonal matrix whose entries are independent :
+        Gaussian variables on the diagonal and chi variables (square root of a chi-squared) with N-1, N-2, ..., 1 
+        degrees of freedom on the sub-diagonal. Replacing these degrees of freedom by beta*(N-1), ..., beta gives 
+        a matrix whose eigenvalues follow the law of the beta-Hermite ensemble, for any real beta > 0 :
+            beta = 1 : GOE (real symmetric),  beta = 2 : GUE (complex hermitian),  beta = 4 : GSE (quaternion).
+    So we only draw 2N-1 random numbers instead of N^2/2, and the diagonalization of a tridiagonal matrix 
+        (symmetric QR without eigenvectors) costs O(N^2) instead of O(N^3).
+
+    The whole matrix is multiplied by scale = 2*sqrt(2/beta) so that the eigenvalues have the same range 
+        as the ones of fill_random_matrix (off-diagonal variance 4) : after division by 2*sqrt(N), 
+        the histogram tends to the same semicircle on [-2,2].
+*/
+void fill_beta_tridiagonal(MT & G, double beta, Eigen::VectorXd & diag, Eigen::VectorXd & subdiag){
+    if(!(beta > 0. && isfinite(beta))){ // chi_squared_distribution needs finite degrees of freedom > 0 (also rejects NaN)
+        throw invalid_argument("beta must be finite and positive, not " + to_string(beta));
+    }
+    int matrixsize = diag.size();
+    double scale = 2. * sqrt(2. / beta);
+    normal_distribution<double> diagonal_distribution(0,1);
+    for(int i = 0; i < matrixsize; i++){
+        diag(i) = scale * diagonal_distribution(G);
+    }
+    for(int i = 0; i < matrixsize - 1; i++){
+        chi_squared_distribution<double> chi2_distribution(beta * (matrixsize - 1 - i));
+        subdiag(i) = scale / sqrt(2.) * sqrt(chi2_distribution(G));
+    }
+}
+
+/*
+    The solver must be built with the default constructor : SelfAdjointEigenSolver(matrixsize) would allocate 
+        an N x N matrix for the eigenvectors, which is not needed here and impossible for very large N.
+*/
+void generate_beta_spectrum(MT & G, double beta, Eigen::VectorXd & diag, Eigen::VectorXd & subdiag, 
+                            Eigen::SelfAdjointEigenSolver<MatrixDouble> & Solver, Eigen::Ref<Eigen::VectorXd> eigenvalues){
+    {
+        PHASE_TIMER(Generation);
+        fill_beta_tridiagonal(G,beta,diag,subdiag);
+    }
+    PHASE_TIMER(Iterations);
+    Solver.computeFromTridiagonal(diag,subdiag,Eigen::EigenvaluesOnly);
+    eigenvalues = Solver.eigenvalues();
+}
+
+/*
+    Time needed to fill the matrix with the two methods (the diagonalization is not included).
+*/
+void compare_matrix_fillers(MT & G, int matrixsize, int nb_samples){
+    MatrixDouble RandomMat(matrixsize,matrixsize);
+    auto start = timer::now();
+    for(int sampl = 0; sampl < nb_samples; sampl++){
+        fill_random_matrix(G,RandomMat);
+    }
+    chrono::duration<double> mt_time = timer::now() - start;
+
+    Xoshiro256 fast_G(G());
+    start = timer::now();
+    for(int sampl = 0; sampl < nb_samples; sampl++){
+        fill_random_lower_triangle(fast_G,RandomMat);
+    }
+    chrono::duration<double> xoshiro_time = timer::now() - start;
+
+    double nb_values = 0.5 * matrixsize * (matrixsize + 1.) * nb_samples;
+    cout << "Fill N = " << matrixsize << " : mt19937 + normal_distribution " << nb_values / mt_time.count() * 1e-6 << " M values/s, "
+         << "xoshiro256+ + Box-Muller by blocks " << nb_values / xoshiro_time.count() * 1e-6 << " M values/s\n";
+}
+
+/*
+    Side by side comparison of the two versions : average time per sample for a few matrix sizes.
+*/
+void compare_spectrum_solvers(MT & G, const vector<int> & sizes, int nb_samples){
+    for(int matrixsize : sizes){
+        auto start = timer::now();
+        for(int sampl = 0; sampl < nb_samples; sampl++){
+            auto spec = generate_random_spectrum(G,matrixsize);
+        }
+        chrono::duration<double> general_time = timer::now() - start;
+
+        SpectrumWorkspace workspace(matrixsize);
+        start = timer::now();
+        for(int sampl = 0; sampl < nb_samples; sampl++){
+            workspace.sample(G);
+        }
+        chrono::duration<double> symmetric_time = timer::now() - start;
+
+        cout << "N = " << matrixsize << " : EigenSolver " << general_time.count() / nb_samples << " s/sample, "
+             << "SelfAdjointEigenSolver " << symmetric_time.count() / nb_samples << " s/sample "
+             << "(x" << general_time.count() / symmetric_time.count() << ")\n";
+    }
+}
+
+/*
+    Moments of a stream of values, computed in one pass : count, mean, variance, skewness, excess kurtosis, minimum and maximum.
+    The naive formulas (sum of x, sum of x^2, ...) lose all their precision when the mean is large compared to the standard deviation, 
+        so we keep the mean and the centered sums M2 = sum (x - mean)^2, M3, M4, updated for each value with the formulas of Welford 
+        (extended to the orders 3 and 4 by Terriberry). 
+    Two sets of moments can be merged (formulas of Chan and Pebay) : this is used for the batches of Histogram::insert and for the threads.
+*/
+class RunningMoments{
+    private :
+        int64_t n;
+        double mean_value;
+        double M2;
+        double M3;
+        double M4;
+        double min_value;
+        double max_value;
+    public :
+        RunningMoments() : n(0), mean_value(0), M2(0), M3(0), M4(0), min_value(INFINITY), max_value(-INFINITY) {}; // constructor
+        RunningMoments(int64_t n, double mean, double M2, double M3, double M4, double min, double max) : 
+            n(n), mean_value(mean), M2(M2), M3(M3), M4(M4), min_value(min), max_value(max) {}; // constructor from the centered sums
+        void add(double x);
+        void merge(const RunningMoments & other);
+        int64_t count() const {return this-> n;}
+        double mean() const {return this-> mean_value;}
+        double variance() const {return (n > 1) ? M2 / (n - 1) : 0.;}
+        double skewness() const {return sqrt(double(n)) * M3 / pow(M2, 1.5);}
+        double kurtosis() const {return n * M4 / (M2 * M2) - 3.;} // Excess kurtosis : 0 for a normal law
+        double min() const {return this-> min_value;}
+        double max() const {return this-> max_value;}
+        void print(ostream & out) const;
+        void write(ostream & out) const; // Binary, exact
+        void read(istream & in);
+};
+
+void RunningMoments::add(double x){
+    int64_t n1 = n;
+    n++;
+    double delta = x - mean_value;
+    double delta_n = delta / n;
+    double delta_n2 = delta_n * delta_n;
+    double term = delta * delta_n * n1;
+    mean_value += delta_n;
+    M4 += term * delta_n2 * (double(n) * n - 3. * n + 3.) + 6. * delta_n2 * M2 - 4. * delta_n * M3;
+    M3 += term * delta_n * (n - 2.) - 3. * delta_n * M2;
+    M2 += term;
+    min_value = std::min(min_value, x);
+    max_value = std::max(max_value, x);
+}
+
+void RunningMoments::merge(const RunningMoments & other){
+    if(other.n == 0){
+        return;
+    }
+    if(n == 0){
+        *this = other;
+        return;
+    }
+    double na = n;
+    double nb = other.n;
+    double n_total = na + nb;
+    double delta = other.mean_value - mean_value;
+    double delta2 = delta * delta;
+    M4 += other.M4 + delta2 * delta2 * na * nb * (na * na - na * nb + nb * nb) / (n_total * n_total * n_total)
+        + 6. * delta2 * (na * na * other.M2 + nb * nb * M2) / (n_total * n_total) + 4. * delta * (na * other.M3 - nb * M3) / n_total;
+    M3 += other.M3 + delta2 * delta * na * nb * (na - nb) / (n_total * n_total) + 3. * delta * (na * other.M2 - nb * M2) / n_total;
+    M2 += other.M2 + delta2 * na * nb / n_total;
+    mean_value += delta * nb / n_total;
+    n += other.n;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+}
+
+void RunningMoments::write(ostream & out) const{
+    double values[6] = {mean_value, M2, M3, M4, min_value, max_value};
+    out.write(reinterpret_cast<const char *>(&n),sizeof(n));
+    out.write(reinterpret_cast<const char *>(values),sizeof(values));
+}
+
+void RunningMoments::read(istream & in){
+    double values[6];
+    in.read(reinterpret_cast<char *>(&n),sizeof(n));
+    in.read(reinterpret_cast<char *>(values),sizeof(values));
+    mean_value = values[0];
+    M2 = values[1];
+    M3 = values[2];
+    M4 = values[3];
+    min_value = values[4];
+    max_value = values[5];
+}
+
+void RunningMoments::print(ostream & out) const{
+    out << n << " values, mean " << mean() << ", variance " << variance() << ", skewness " << skewness() 
+        << ", excess kurtosis " << kurtosis() << ", min " << min() << ", max " << max();
+}
+
+/*
+    The bins can be :
+        - Linear : K bins of the same width on [a,b[ (the original histogram) ;
+        - Logarithmic : K bins whose edges form a geometric sequence from a to b (0 < a < b), for values spread over several orders of magnitude ;
+        - Custom : any increasing sequence of K+1 edges.
+    For the linear and logarithmic bins the index is computed directly : floor((x - a) * K / (b - a)) or floor((log(x) - log(a)) * K / log(b/a)), 
+        the inverse of the width is computed once in the constructor, so there is no division per value. 
+        For custom edges, the bin is found by a binary search in the edges.
+*/
+enum BinScale {Linear, Logarithmic, Custom};
+
 class Histogram{
     private :
+        static const int nb_lanes = 4;
+        static const int chunk_size = 256;
         double a;
         double b;
         double delta;
-        vector<int> bars;
-        int nb_out_of_box;
+        BinScale scale;
+        double origin; // a, or log(a) for the logarithmic bins
+        double inverse_width; // K / (b - a), or K / log(b/a)
+        vector<double> edges; // K+1 edges of the bins
+        vector<int64_t> bars; // 64 bits : with 10^5 samples of size 2000, an int would overflow
+        int64_t nb_out_of_box;
+        RunningMoments statistics; // Moments of all the values added, in the box or not
+        vector<int32_t> lane_counts; // Buffers of insert, nb_lanes x (K+1)
+        void set_edges();
+        static const vector<double> & checked_edges(const vector<double> & edges); // Throws an exception if the edges are not valid
+        static double checked_bounds(double a, double b, int K, BinScale scale); // Same for the bounds of linear or logarithmic bins, returns a
+        int bin_index(double x) const; // Index of the bin of x, K if x is out of [a,b[ (or NaN)
     public :
-        Histogram(double a, double b, int K) : a(a), b(b), delta((b-a) / K), bars(K,0), nb_out_of_box(0) {}; // constructor
+        Histogram(double a, double b, int K, BinScale scale = Linear); // constructor
+        Histogram(const vector<double> & edges); // constructor for custom bins
+        Histogram(double a, double b, const vector<int64_t> & bars, int64_t nb_out_of_box, const RunningMoments & statistics = RunningMoments()); // constructor from the counts
         double lower_bound() const {return this-> a;}
         double upper_bound() const {return this-> b;}
         int nb_boxes() const {return this->bars.size();}
-        int nb_out_of_domain() const {return this-> nb_out_of_box;}
+        BinScale bin_scale() const {return this-> scale;}
+        int64_t nb_out_of_domain() const {return this-> nb_out_of_box;}
+        int64_t count(int k) const {return this-> bars[k];}
+        double edge(int k) const {return this-> edges[k];}
+        const RunningMoments & moments() const {return this-> statistics;}
         bool operator +=(double x); // Add a data point by incrementing the correct slot in the histogram with h += x
+        int insert(const Eigen::Ref<const Eigen::VectorXd> & values, double factor = 1.); // Adds factor * values[i] for all i, returns the number of values in the box
+        void add_counts(const vector<int64_t> & counts, int64_t nb_out); // Counts known without the values (Sturm sequences) : the moments do not change
         void print(ostream & out) const; // Display on the out stream
-        void reset() {return fill(bars.begin(),bars.end(),0); nb_out_of_box = 0;}
+        bool merge(const Histogram & other); // Add the counts of another histogram with the same bins
+        void reset() {fill(bars.begin(),bars.end(),0); nb_out_of_box = 0; statistics = RunningMoments();}
+        void write(ostream & out) const; // Binary snapshot : bins, counts and moments, without any loss
+        void read(istream & in); // Reads a snapshot of a histogram with the same bins (throws an exception otherwise)
         };
 
+Histogram::Histogram(double a, double b, int K, BinScale scale) : 
+    a(checked_bounds(a, b, K, scale)), b(b), delta((b-a) / K), scale(scale), edges(K + 1), bars(K,0), nb_out_of_box(0), lane_counts(nb_lanes * (K + 1), 0){
+    if(scale == Logarithmic){
+        origin = log(a);
+        inverse_width = K / log(b / a);
+    }
+    else{
+        origin = a;
+        inverse_width = K / (b - a);
+    }
+    set_edges();
+}
+
+/*
+    The binary search of bin_index needs at least two finite and strictly increasing edges.
+*/
+const vector<double> & Histogram::checked_edges(const vector<double> & edges){
+    if(edges.size() < 2){
+        throw runtime_error("A histogram needs at least two edges");
+    }
+    for(size_t k = 0; k < edges.size(); k++){
+        if(!isfinite(edges[k]) || (k > 0 && !(edges[k - 1] < edges[k]))){
+            throw runtime_error("The edges of a histogram must be finite and strictly increasing");
+        }
+    }
+    return edges;
+}
+
+/*
+    Linear and logarithmic bins need K >= 1 and finite bounds a < b, and the logarithmic bins a > 0 
+        (with a = 0, log(a) = -inf and all the edges would be NaN).
+*/
+double Histogram::checked_bounds(double a, double b, int K, BinScale scale){
+    if(K < 1){
+        throw runtime_error("A histogram needs at least one bin");
+    }
+    if(!isfinite(a) || !isfinite(b) || !(a < b)){
+        throw runtime_error("The bounds of a histogram must be finite and a < b");
+    }
+    if(scale == Logarithmic && !(a > 0.)){
+        throw runtime_error("The lower bound of logarithmic bins must be positive");
+    }
+    return a;
+}
+
+Histogram::Histogram(const vector<double> & edges) : 
+    a(checked_edges(edges).front()), b(edges.back()), delta((b-a) / (edges.size() - 1)), scale(Custom), origin(a), inverse_width(1. / delta), 
+    edges(edges), bars(edges.size() - 1,0), nb_out_of_box(0), lane_counts(nb_lanes * edges.size(), 0) {}
+
+Histogram::Histogram(double a, double b, const vector<int64_t> & bars, int64_t nb_out_of_box, const RunningMoments & statistics) : 
+    Histogram(a, b, bars.size()){
+    this->bars = bars;
+    this->nb_out_of_box = nb_out_of_box;
+    this->statistics = statistics;
+}
+
+void Histogram::set_edges(){
+    int K = bars.size();
+    for(int k = 0; k <= K; k++){
+        edges[k] = (scale == Logarithmic) ? a * pow(b / a, double(k) / K) : a + k * delta;
+    }
+    edges[K] = b;
+}
+
+int Histogram::bin_index(double x) const{
+    int K = bars.size();
+    if(scale == Custom){
+        if(!(x >= a && x < b)){
+            return K;
+        }
+        return std::upper_bound(edges.begin(), edges.end(), x) - edges.begin() - 1;
+    }
+    double t = ((scale == Logarithmic) ? log(x) - origin : x - origin) * inverse_width;
+    return (t >= 0. && t < K) ? int(t) : K; // For t >= 0, the conversion to int is the floor ; NaN fails both tests
+}
+
 bool Histogram::operator +=(double x){
-    int k = floor((x - a) / delta);
-    if((k >= 0 ) && (k < bars.size())){
+    statistics.add(x);
+    int k = bin_index(x);
+    if(k < int(bars.size())){
         bars[k]++;
         return true;
     }
@@ -67,50 +661,1239 @@ bool Histogram::operator +=(double x){
     }
 }
 
+/*
+    Batch insertion, for all the eigenvalues of a sample at once. The values are processed by chunks of 256 that stay in the L1 cache, 
+        and each chunk is read in three loops without any branch :
+        - the bin indices, with a multiplication by the inverse of the width and a conversion to int (the compiler vectorizes this loop 
+          for the linear bins ; out of the box values get the index K) ;
+        - the power sums of (x - shift), computed with Eigen arrays (Eigen vectorizes the sums itself, the compiler does not reorder 
+          additions of doubles) ; they give the centered moments of the chunk, merged with the moments of the histogram. 
+          shift is the current mean, so the sums do not lose precision ;
+        - the increments of the bins. The eigenvalues are sorted, so consecutive values often fall in the same bin : 
+          with a single counter, each increment would wait for the previous one to be written. 
+          The values are distributed among nb_lanes copies of the counters (value i goes to the copy i % nb_lanes), 
+          which are independent, and the copies are added to the bars at the end of the chunk (only between the smallest and the largest index ; 
+          when the values of the chunk are spread over more than chunk_size / nb_lanes bins, the bars are incremented directly).
+    The factor (for example 1/(2 sqrt(N))) is applied inside the chunk, so the caller does not need to copy the values.
+*/
+int Histogram::insert(const Eigen::Ref<const Eigen::VectorXd> & values, double factor){
+    const int K = bars.size();
+    double scaled[chunk_size];
+    int indices[chunk_size];
+    int nb_in_box = 0;
+    for(Eigen::Index start = 0; start < values.size(); start += chunk_size){
+        const int count = min<Eigen::Index>(chunk_size, values.size() - start);
+        Eigen::Map<Eigen::ArrayXd>(scaled, count) = factor * values.segment(start, count).array();
+        fill(scaled + count, scaled + chunk_size, NAN); // The last chunk is completed with NaN, which are out of the box
+        if(scale == Linear){
+            for(int i = 0; i < chunk_size; i++){ // Constant number of iterations : vectorized even at -O2
+                double t = (scaled[i] - origin) * inverse_width;
+                indices[i] = int(((t >= 0.) & (t < K)) ? t : K); // No branch : selection on doubles, then one conversion
+            }
+        }
+        else{
+            for(int i = 0; i < chunk_size; i++){
+                indices[i] = bin_index(scaled[i]);
+            }
+        }
+
+        Eigen::Map<const Eigen::ArrayXd> y(scaled, count);
+        double shift = (statistics.count() > 0) ? statistics.mean() : y(0);
+        double s1 = (y - shift).sum();
+        double s2 = (y - shift).square().sum();
+        double s3 = (y - shift).cube().sum();
+        double s4 = (y - shift).square().square().sum();
+        double m = s1 / count; // mean of the chunk - shift
+        statistics.merge(RunningMoments(count, shift + m, s2 - count * m * m, s3 - 3. * m * s2 + 2. * count * m * m * m, 
+                                        s4 - 4. * m * s3 + 6. * m * m * s2 - 3. * count * m * m * m * m, y.minCoeff(), y.maxCoeff()));
+
+        int k_min = K;
+        int k_max = 0;
+        for(int i = 0; i < chunk_size; i++){
+            k_min = min(k_min, indices[i]);
+            k_max = max(k_max, indices[i]);
+        }
+        if((k_max - k_min + 1) * nb_lanes > count){ // Values spread over many bins : the copies would cost more than they save
+            for(int i = 0; i < count; i++){
+                if(indices[i] < K){
+                    bars[indices[i]]++;
+                    nb_in_box++;
+                }
+                else{
+                    nb_out_of_box++;
+                }
+            }
+            continue;
+        }
+        int i = 0;
+        for(; i + nb_lanes <= count; i += nb_lanes){
+            for(int lane = 0; lane < nb_lanes; lane++){
+                lane_counts[lane * (K + 1) + indices[i + lane]]++;
+            }
+        }
+        for(; i < count; i++){
+            lane_counts[indices[i]]++;
+        }
+        for(int k = k_min; k <= k_max; k++){
+            int64_t total = 0;
+            for(int lane = 0; lane < nb_lanes; lane++){
+                total += lane_counts[lane * (K + 1) + k];
+                lane_counts[lane * (K + 1) + k] = 0;
+            }
+            if(k < K){
+                bars[k] += total;
+                nb_in_box += total;
+            }
+            else{
+                nb_out_of_box += total;
+            }
+        }
+    }
+    return nb_in_box;
+}
+
+
+void Histogram::add_counts(const vector<int64_t> & counts, int64_t nb_out){
+    for(size_t k = 0; k < bars.size(); k++){
+        bars[k] += counts[k];
+    }
+    nb_out_of_box += nb_out;
+}
+
+/*
+    Merging is used to gather the histograms filled separately by each thread. 
+    The two histograms must have the same bins, otherwise nothing is done and false is returned.
+*/
+bool Histogram::merge(const Histogram & other){
+    if((scale != other.scale) || (edges != other.edges)){
+        return false;
+    }
+    for(size_t k = 0; k < bars.size(); k++){
+        bars[k] += other.bars[k];
+    }
+    nb_out_of_box += other.nb_out_of_box;
+    statistics.merge(other.statistics);
+    return true;
+}
+
+/*
+    Binary snapshot : the kind of bins (int32_t), K (int64_t), the K+1 edges, the K counts and the number of values out of the box (int64_t), 
+        then the moments. Unlike print, nothing is rounded : a histogram read from a snapshot is exactly the one that was written.
+*/
+void Histogram::write(ostream & out) const{
+    int32_t kind = scale;
+    int64_t K = bars.size();
+    out.write(reinterpret_cast<const char *>(&kind),sizeof(kind));
+    out.write(reinterpret_cast<const char *>(&K),sizeof(K));
+    out.write(reinterpret_cast<const char *>(edges.data()),edges.size() * sizeof(double));
+    out.write(reinterpret_cast<const char *>(bars.data()),bars.size() * sizeof(int64_t));
+    out.write(reinterpret_cast<const char *>(&nb_out_of_box),sizeof(nb_out_of_box));
+    statistics.write(out);
+}
+
+void Histogram::read(istream & in){
+    int32_t kind;
+    int64_t K;
+    in.read(reinterpret_cast<char *>(&kind),sizeof(kind));
+    in.read(reinterpret_cast<char *>(&K),sizeof(K));
+    if(!in || kind != scale || K != int64_t(bars.size())){
+        throw runtime_error("The histogram of the snapshot does not have the same bins");
+    }
+    vector<double> snapshot_edges(K + 1);
+    in.read(reinterpret_cast<char *>(snapshot_edges.data()),snapshot_edges.size() * sizeof(double));
+    if(!in || snapshot_edges != edges){
+        throw runtime_error("The histogram of the snapshot does not have the same bins");
+    }
+    in.read(reinterpret_cast<char *>(bars.data()),bars.size() * sizeof(int64_t));
+    in.read(reinterpret_cast<char *>(&nb_out_of_box),sizeof(nb_out_of_box));
+    statistics.read(in);
+    if(!in){
+        throw runtime_error("Incomplete histogram snapshot");
+    }
+}
 
 /*
     We will write two numbers separated by a space on each line : 
         the center of the k-th bin and the height of the associated bar in the histogram.
+    When the bins do not have the same width, a third number is the density : the height divided by the width of the bin.
 */
 void Histogram::print(ostream & out) const{
     double middle_point;
     double normalized_value;
-    int total_number_points = nb_out_of_box + accumulate(bars.begin(),bars.end(),0);
+    int64_t total_number_points = nb_out_of_box + accumulate(bars.begin(),bars.end(),int64_t(0));
     for(int i = 0; i < bars.size(); i++){
-        middle_point = a + (i * 0.5) * delta;
+        middle_point = 0.5 * (edges[i] + edges[i + 1]);
         normalized_value = bars[i] / double(total_number_points);
-        out << middle_point << " " << normalized_value << "\n";
+        out << middle_point << " " << normalized_value;
+        if(scale != Linear){
+            out << " " << normalized_value / (edges[i + 1] - edges[i]);
+        }
+        out << "\n";
+    }
+}
+
+/*
+    Histogram shared by several threads.
+    With a single array of counters, all the threads would write in the same cache lines : even with atomic operations, 
+        each increment has to take the cache line from the processor that modified it last, which is very slow.
+    Here the counters are split into nb_shards copies (shards), and each thread writes in its own shard : 
+        the caller gives the shard, usually the number of the thread (0, 1, ..., taken modulo nb_shards), 
+        so that the threads of one run never share a shard when there are enough shards. 
+        Each shard starts on a new cache line (64 bytes) : two threads never write in the same cache line.
+    The counters are 64 bits atomic integers incremented with memory_order_relaxed (no ordering with the other memory operations is needed), 
+        so the result is still correct if two threads share a shard (more threads than shards). 
+    snapshot() adds the shards into a Histogram : it can be called at any time, even while other threads insert values.
+    The moments (RunningMoments) cannot be updated with atomic operations : each shard has its own moments, protected by a spin lock 
+        that only its thread takes (except snapshot()). They are only updated by merge() : add() stays a single atomic addition, 
+        and its values are counted in the bins but not in the moments. The fast way to fill it is to add a batch of values 
+        to a local Histogram with insert(), then to merge this histogram : K atomic additions and one lock per batch. 
+        Since the shard is the number of the thread, the moments are reproducible (they are merged in the same order at each run). 
+    h += x is also available, with the same interface as Histogram (see operator +=).
+*/
+class ConcurrentHistogram{
+    private :
+        struct alignas(64) CacheLine{
+            atomic<uint64_t> counts[8];
+        };
+        struct alignas(64) ShardMoments{
+            atomic_flag lock = ATOMIC_FLAG_INIT;
+            RunningMoments moments;
+        };
+        double a;
+        double b;
+        double inverse_width;
+        int K;
+        int nb_shards;
+        int lines_per_shard; // K bins + 1 counter for the values out of [a,b[, rounded up to a number of cache lines
+        vector<CacheLine> lines;
+        mutable vector<ShardMoments> shard_moments;
+        atomic<uint64_t> & counter(int shard, int k) {return lines[shard * lines_per_shard + k / 8].counts[k % 8];}
+        int shard_index(int shard) const; // shard modulo nb_shards
+        static int checked_shards(double a, double b, int K, int nb_shards); // Throws an exception if the bins or the number of shards are not valid
+        template <class FUNC>
+            static void with_lock(ShardMoments & shard, FUNC func){
+                while(shard.lock.test_and_set(memory_order_acquire)) {}
+                func(shard.moments);
+                shard.lock.clear(memory_order_release);
+            }
+    public :
+        ConcurrentHistogram(double a, double b, int K, int nb_shards); // constructor
+        double lower_bound() const {return this-> a;}
+        double upper_bound() const {return this-> b;}
+        int nb_boxes() const {return this-> K;}
+        bool add(double x, int shard); // Same bins as Histogram::operator +=, can be called by several threads at the same time (no moments)
+        bool operator +=(double x); // h += x like Histogram, in the shard given by a hash of the id of the calling thread
+        void merge(const Histogram & h, int shard); // Adds the counts and moments of a histogram with the same linear bins (throws an exception otherwise)
+        Histogram snapshot() const; // Sum of all the shards
+        Histogram shard_snapshot(int shard) const; // Counts and moments of one shard (0 <= shard < nb_shards)
+        void print(ostream & out) const {snapshot().print(out);}
+};
+
+int ConcurrentHistogram::checked_shards(double a, double b, int K, int nb_shards){
+    if(K < 1 || !isfinite(a) || !isfinite(b) || !(a < b)){
+        throw runtime_error("ConcurrentHistogram needs at least one bin and finite bounds a < b");
+    }
+    if(nb_shards < 1){
+        throw runtime_error("ConcurrentHistogram needs at least one shard");
     }
+    return nb_shards;
 }
 
-int main(){
+ConcurrentHistogram::ConcurrentHistogram(double a, double b, int K, int nb_shards) : 
+    a(a), b(b), inverse_width(K / (b-a)), K(K), nb_shards(checked_shards(a, b, K, nb_shards)), lines_per_shard((K + 1 + 7) / 8), lines(nb_shards * lines_per_shard), 
+    shard_moments(nb_shards){
+    for(auto & line : lines){
+        for(auto & c : line.counts){
+            c.store(0, memory_order_relaxed);
+        }
+    }
+}
+
+int ConcurrentHistogram::shard_index(int shard) const{
+    if(shard < 0){
+        throw runtime_error("Negative shard " + to_string(shard));
+    }
+    return shard % nb_shards;
+}
+
+bool ConcurrentHistogram::add(double x, int shard){
+    double t = (x - a) * inverse_width; // Same bins as Histogram
+    bool in_box = (t >= 0.) && (t < K);
+    counter(shard_index(shard), in_box ? int(t) : K).fetch_add(1, memory_order_relaxed);
+    return in_box;
+}
+
+/*
+    The shard only depends on the thread, so that the existing h += x calls can be used with several threads. 
+    Two threads can get the same shard (the counters are atomic, the counts are still correct), 
+        and the shard of a thread changes from one run to the next : use add(x, shard) to choose the shards.
+*/
+bool ConcurrentHistogram::operator +=(double x){
+    return add(x, int(hash<thread::id>{}(this_thread::get_id()) % nb_shards));
+}
+
+void ConcurrentHistogram::merge(const Histogram & h, int shard){
+    if(h.bin_scale() != Linear || h.nb_boxes() != K || h.lower_bound() != a || h.upper_bound() != b){
+        throw runtime_error("ConcurrentHistogram::merge : the histogram does not have the same bins");
+    }
+    shard = shard_index(shard);
+    for(int k = 0; k < K; k++){
+        counter(shard, k).fetch_add(h.count(k), memory_order_relaxed);
+    }
+    counter(shard, K).fetch_add(h.nb_out_of_domain(), memory_order_relaxed);
+    with_lock(shard_moments[shard], [&](RunningMoments & moments){moments.merge(h.moments());});
+}
+
+Histogram ConcurrentHistogram::shard_snapshot(int shard) const{
+    if(shard < 0 || shard >= nb_shards){
+        throw runtime_error("No shard " + to_string(shard) + " in a ConcurrentHistogram with " + to_string(nb_shards) + " shards");
+    }
+    vector<int64_t> bars(K, 0);
+    RunningMoments moments;
+    auto & self = const_cast<ConcurrentHistogram &>(*this); // counter() is not const, but load() does not modify anything
+    for(int k = 0; k < K; k++){
+        bars[k] = self.counter(shard, k).load(memory_order_relaxed);
+    }
+    with_lock(shard_moments[shard], [&](RunningMoments & m){moments = m;});
+    return Histogram(a, b, bars, self.counter(shard, K).load(memory_order_relaxed), moments);
+}
+
+Histogram ConcurrentHistogram::snapshot() const{
+    Histogram h(a, b, K);
+    for(int shard = 0; shard < nb_shards; shard++){
+        h.merge(shard_snapshot(shard));
+    }
+    return h;
+}
+
+/*
+    Histogram::insert must give exactly the same counts as operator+= value by value, and the same moments up to rounding errors, 
+        for the three kinds of bins. Returns false (and prints the differences) otherwise.
+*/
+bool check_histogram_insert(MT & G, int nb_values){
+    Eigen::VectorXd values(nb_values);
+    normal_distribution<double> distribution(0, 1);
+    for(auto & x : values){
+        x = distribution(G);
+    }
+    sort(values.begin(), values.end()); // Like the eigenvalues
+    double factor = 0.5;
+    vector<Histogram> by_value = {Histogram(-1., 1., 20), Histogram(1e-3, 10., 12, Logarithmic), Histogram({-2., -0.5, 0., 0.1, 0.2, 1.})};
+    vector<Histogram> by_batch = by_value;
+    bool ok = true;
+    for(size_t h = 0; h < by_value.size(); h++){
+        for(auto x : values){
+            by_value[h] += factor * x;
+        }
+        by_batch[h].insert(values.head(nb_values / 3), factor); // Two batches, to check the merge of the moments
+        by_batch[h].insert(values.tail(nb_values - nb_values / 3), factor);
+        bool same_counts = (by_value[h].nb_out_of_domain() == by_batch[h].nb_out_of_domain());
+        for(int k = 0; k < by_value[h].nb_boxes(); k++){
+            same_counts = same_counts && (by_value[h].count(k) == by_batch[h].count(k));
+        }
+        const RunningMoments & m1 = by_value[h].moments();
+        const RunningMoments & m2 = by_batch[h].moments();
+        double error = max({abs(m1.mean() - m2.mean()), abs(m1.variance() - m2.variance()), 
+                            abs(m1.skewness() - m2.skewness()), abs(m1.kurtosis() - m2.kurtosis())});
+        if(!same_counts || error > 1e-10 || m1.min() != m2.min() || m1.max() != m2.max()){
+            cout << "Histogram::insert differs from operator+= (histogram " << h << ", error on the moments " << error << ")\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/*
+    Histogram without the eigenvalues : Sturm sequences.
+    For the histogram we only need the number of eigenvalues in each bin. For a symmetric tridiagonal matrix T (diagonal a, sub-diagonal b), 
+        the decomposition T - x I = L D L^T (Gaussian elimination without pivoting) gives
+            d_1 = a_1 - x,    d_i = (a_i - x) - b_{i-1}^2 / d_{i-1},
+        and by the law of inertia of Sylvester, the number of negative d_i is the number of eigenvalues smaller than x.
+    With the K+1 edges of the bins, the number of eigenvalues in [e_k, e_{k+1}[ is count(e_{k+1}) - count(e_k) : 
+        O(N K) operations, no iteration and no convergence test, instead of the QR iterations (O(N^2)).
+    The recurrences of the different edges are independent : the edges are processed by blocks of 8 and the loop on the edges of a block 
+        (fixed length, without branch) is vectorized by the compiler. A pivot d_i = 0 is replaced by -pivmin, as in LAPACK (dstebz).
+    The counts are exact as long as no eigenvalue is within rounding errors of an edge.
+*/
+void count_eigenvalues_below(const Eigen::VectorXd & diag, const Eigen::VectorXd & subdiag, const vector<double> & points, vector<int64_t> & counts){
+    const int block_size = 8;
+    int matrixsize = diag.size();
+    int nb_points = points.size();
+    double pivmin = numeric_limits<double>::min() * max(1., subdiag.size() > 0 ? subdiag.squaredNorm() : 0.);
+    counts.resize(nb_points);
+    for(int start = 0; start < nb_points; start += block_size){
+        double x[block_size];
+        double d[block_size];
+        double negatives[block_size]; // Counted in double : exact up to 2^53, and the loop stays in double
+        for(int j = 0; j < block_size; j++){
+            x[j] = points[min(start + j, nb_points - 1)]; // The last block is completed with copies of the last point
+        }
+        for(int j = 0; j < block_size; j++){
+            d[j] = diag(0) - x[j];
+            d[j] = (d[j] == 0.) ? -pivmin : d[j];
+            negatives[j] = (d[j] < 0.) ? 1. : 0.;
+        }
+        for(int i = 1; i < matrixsize; i++){
+            double a = diag(i);
+            double b2 = subdiag(i - 1) * subdiag(i - 1);
+            for(int j = 0; j < block_size; j++){
+                d[j] = (a - x[j]) - b2 / d[j];
+                d[j] = (d[j] == 0.) ? -pivmin : d[j];
+                negatives[j] += (d[j] < 0.) ? 1. : 0.;
+            }
+        }
+        for(int j = 0; j < block_size && start + j < nb_points; j++){
+            counts[start + j] = int64_t(negatives[j]);
+        }
+    }
+}
+
+/*
+    Adds the eigenvalues of the tridiagonal matrix, multiplied by factor, to the histogram (any kind of bins), without computing them.
+    points and counts are buffers given by the caller (no allocation after the first call).
+*/
+void sturm_histogram(const Eigen::VectorXd & diag, const Eigen::VectorXd & subdiag, double factor, Histogram & h, 
+                     vector<double> & points, vector<int64_t> & counts){
+    int K = h.nb_boxes();
+    points.resize(K + 1);
+    for(int k = 0; k <= K; k++){
+        points[k] = h.edge(k) / factor;
+    }
+    count_eigenvalues_below(diag,subdiag,points,counts);
+    int64_t nb_out = counts[0] + (diag.size() - counts[K]);
+    for(int k = 0; k < K; k++){
+        counts[k] = counts[k + 1] - counts[k];
+    }
+    counts.resize(K);
+    h.add_counts(counts,nb_out);
+}
+
+/*
+    Same histogram with the Sturm counts and with the eigenvalues given by the QR iterations, for the same matrices 
+        (full matrices reduced by SpectrumWorkspace, and the tridiagonal model), and time of both methods.
+*/
+bool check_sturm_histogram(Xoshiro256 & G, int matrixsize, int nb_samples){
+    double factor = 1. / (2.*sqrt(matrixsize));
+    SpectrumWorkspace workspace(matrixsize);
+    Histogram h_qr(-3.,3.,20), h_sturm(-3.,3.,20);
+    vector<double> points;
+    vector<int64_t> counts;
+    for(int sampl = 0; sampl < nb_samples; sampl++){
+        h_qr.insert(workspace.sample(G),factor);
+        sturm_histogram(workspace.tridiagonal_diagonal(),workspace.tridiagonal_subdiagonal(),factor,h_sturm,points,counts);
+    }
+    bool identical = (h_qr.nb_out_of_domain() == h_sturm.nb_out_of_domain());
+    for(int k = 0; k < h_qr.nb_boxes(); k++){
+        identical = identical && (h_qr.count(k) == h_sturm.count(k));
+    }
+
+    auto start = timer::now();
+    for(int sampl = 0; sampl < nb_samples; sampl++){
+        h_qr.insert(workspace.sample(G),factor);
+    }
+    chrono::duration<double> qr_time = timer::now() - start;
+    start = timer::now();
+    for(int sampl = 0; sampl < nb_samples; sampl++){
+        workspace.sample_tridiagonal(G);
+        PHASE_TIMER(Binning);
+        sturm_histogram(workspace.tridiagonal_diagonal(),workspace.tridiagonal_subdiagonal(),factor,h_sturm,points,counts);
+    }
+    chrono::duration<double> sturm_time = timer::now() - start;
+    cout << "N = " << matrixsize << " : Sturm counts " << (identical ? "identical" : "DIFFERENT") << " to the QR eigenvalues, " 
+         << "QR + insert " << qr_time.count() / nb_samples << " s/sample, reduction + Sturm " << sturm_time.count() / nb_samples << " s/sample" << endl;
+
+    // Tridiagonal model : no reduction, the difference is much larger
+    int large_size = 5000;
+    MT beta_G(1);
+    Eigen::VectorXd diag(large_size), subdiag(large_size - 1), spec(large_size);
+    Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver;
+    Histogram h_beta_qr(-3.,3.,20), h_beta_sturm(-3.,3.,20);
+    factor = 1. / (2.*sqrt(large_size));
+    start = timer::now();
+    generate_beta_spectrum(beta_G,1.,diag,subdiag,Solver,spec);
+    h_beta_qr.insert(spec,factor);
+    qr_time = timer::now() - start;
+    start = timer::now();
+    sturm_histogram(diag,subdiag,factor,h_beta_sturm,points,counts);
+    sturm_time = timer::now() - start;
+    bool identical_beta = (h_beta_qr.nb_out_of_domain() == h_beta_sturm.nb_out_of_domain());
+    for(int k = 0; k < h_beta_qr.nb_boxes(); k++){
+        identical_beta = identical_beta && (h_beta_qr.count(k) == h_beta_sturm.count(k));
+    }
+    cout << "Tridiagonal model N = " << large_size << " : Sturm counts " << (identical_beta ? "identical" : "DIFFERENT") 
+         << ", generation + QR " << qr_time.count() << " s, Sturm " << sturm_time.count() << " s" << endl;
+    return identical && identical_beta;
+}
+
+/*
+    Accuracy and time of the three precisions of BasicSpectrumWorkspace, compared with the double version on the same matrices 
+        (generated in double, then converted) : largest error on a normalized eigenvalue, number of eigenvalues that change of bin 
+        (sum over the bins of |difference| / number of eigenvalues), and time per sample (each version generates its own matrices).
+*/
+void precision_report(Xoshiro256 & G, const vector<int> & sizes, int nb_samples){
+    for(int matrixsize : sizes){
+        double factor = 1. / (2.*sqrt(matrixsize));
+        MatrixDouble M(matrixsize,matrixsize);
+        BasicSpectrumWorkspace<double> double_workspace(matrixsize);
+        BasicSpectrumWorkspace<float> float_workspace(matrixsize);
+        BasicSpectrumWorkspace<float,double> mixed_workspace(matrixsize);
+        Histogram h_double(-3.,3.,20), h_float(-3.,3.,20), h_mixed(-3.,3.,20);
+        double error_float = 0., error_mixed = 0.;
+        for(int sampl = 0; sampl < nb_samples; sampl++){
+            fill_random_lower_triangle(G,M);
+            const Eigen::VectorXd & exact = double_workspace.spectrum_of(M);
+            Eigen::VectorXd float_spectrum = float_workspace.spectrum_of(M).cast<double>();
+            const Eigen::VectorXd & mixed_spectrum = mixed_workspace.spectrum_of(M);
+            error_float = max(error_float,(float_spectrum - exact).cwiseAbs().maxCoeff() * factor);
+            error_mixed = max(error_mixed,(mixed_spectrum - exact).cwiseAbs().maxCoeff() * factor);
+            h_double.insert(exact,factor);
+            h_float.insert(float_spectrum,factor);
+            h_mixed.insert(mixed_spectrum,factor);
+        }
+        auto bin_changes = [&](const Histogram & h){
+            double difference = abs(h.nb_out_of_domain() - h_double.nb_out_of_domain());
+            for(int k = 0; k < h.nb_boxes(); k++){
+                difference += abs(h.count(k) - h_double.count(k));
+            }
+            return difference / (double(matrixsize) * nb_samples);
+        };
+        auto time_per_sample = [&](auto & workspace){
+            Xoshiro256 time_G(1);
+            workspace.sample(time_G); // Warm-up
+            auto start = timer::now();
+            for(int sampl = 0; sampl < nb_samples; sampl++){
+                workspace.sample(time_G);
+            }
+            chrono::duration<double> time = timer::now() - start;
+            return time.count() / nb_samples;
+        };
+        cout << "N = " << matrixsize << " : double " << time_per_sample(double_workspace) << " s/sample ; "
+             << "float " << time_per_sample(float_workspace) << " s/sample, error " << error_float << ", bin changes " << bin_changes(h_float) << " ; "
+             << "mixed " << time_per_sample(mixed_workspace) << " s/sample, error " << error_mixed << ", bin changes " << bin_changes(h_mixed) << endl;
+    }
+}
+
+/*
+    Sparse ensembles.
+    The dense matrices cost O(N^2) in memory and O(N^3) to diagonalize : N = 10^4 is already long. 
+    The adjacency matrices of random graphs and the band matrices only have a few non-zero coefficients per row, 
+        so we build them directly in a SparseMatrix (list of triplets and a single setFromTriplets, as in Sec2), 
+        and we never make them dense : the methods below only use products H * v, which cost O(nnz).
+    - Erdos-Renyi : each edge {i,j} exists with probability p. Instead of drawing N^2/2 uniform numbers, we jump directly to the next edge : 
+      the number of missing edges before the next one follows a geometric law, drawn with log(u) / log(1-p). Cost O(N + nnz).
+    - Band matrix : the coefficients with |i - j| <= bandwidth are random (same law as fill_random_matrix), the others are zero.
+    - Random d-regular graph : every vertex has exactly d neighbours. Configuration model : each vertex gets d "half-edges", 
+      the half-edges are shuffled and paired two by two. The loops (i,i) and the double edges are then repaired by switches : 
+      a bad edge (u,v) and a random edge (x,y) are replaced by (u,x) and (v,y) when these two edges are new.
+    With the normalization factors used below, the histograms of the three ensembles are on [-2,2] like the GOE 
+        (semicircle for Erdos-Renyi and the band matrices, Kesten-McKay law for the regular graphs), plus a few outliers 
+        (for example the largest eigenvalue of Erdos-Renyi, close to N p).
+*/
+SparseMatrix erdos_renyi_matrix(Xoshiro256 & G, int matrixsize, double p){
+    if(!(p >= 0. && p <= 1.)){ // Also rejects NaN
+        throw invalid_argument("The probability of an edge must be in [0,1], not " + to_string(p));
+    }
+    vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(size_t(1.1 * matrixsize * (matrixsize - 1.) * p) + 16);
+    if(p == 1.){ // Complete graph : no jump to draw
+        for(int i = 0; i < matrixsize; i++){
+            for(int j = i + 1; j < matrixsize; j++){
+                triplets.emplace_back(i,j,1.);
+                triplets.emplace_back(j,i,1.);
+            }
+        }
+    }
+    else if(p > 0.){ // p = 0 : no edge, the matrix stays empty
+        double log_q = log1p(-p);
+        for(int i = 0; i < matrixsize; i++){
+            double j = i;
+            while(true){
+                j += 1. + floor(log(1. - G.uniform()) / log_q); // Geometric jump
+                if(j >= matrixsize) break;
+                triplets.emplace_back(i,int(j),1.);
+                triplets.emplace_back(int(j),i,1.);
+            }
+        }
+    }
+    SparseMatrix H(matrixsize,matrixsize);
+    H.setFromTriplets(triplets.begin(),triplets.end());
+    return H;
+}
+
+SparseMatrix band_random_matrix(Xoshiro256 & G, int matrixsize, int bandwidth){
+    vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(size_t(matrixsize) * (2 * bandwidth + 1));
+    vector<double> column(bandwidth + 1);
+    for(int j = 0; j < matrixsize; j++){
+        int count = min(bandwidth + 1, matrixsize - j);
+        fill_normals(G,column.data(),count,2.);
+        triplets.emplace_back(j,j,0.5 * column[0]); // The diagonal has a standard deviation of 1
+        for(int k = 1; k < count; k++){
+            triplets.emplace_back(j + k,j,column[k]);
+            triplets.emplace_back(j,j + k,column[k]);
+        }
+    }
+    SparseMatrix H(matrixsize,matrixsize);
+    H.setFromTriplets(triplets.begin(),triplets.end());
+    return H;
+}
+
+SparseMatrix random_regular_graph(Xoshiro256 & G, int matrixsize, int degree){
+    if(degree < 0 || (long(matrixsize) * degree) % 2 != 0 || degree >= matrixsize){
+        throw invalid_argument("No " + to_string(degree) + "-regular graph with " + to_string(matrixsize) + " vertices");
+    }
+    vector<int> half_edges(long(matrixsize) * degree);
+    for(size_t k = 0; k < half_edges.size(); k++){
+        half_edges[k] = k / degree;
+    }
+    shuffle(half_edges.begin(),half_edges.end(),G);
+    size_t nb_edges = half_edges.size() / 2;
+    vector<pair<int,int>> edges(nb_edges);
+    auto key = [](int u, int v) {return (uint64_t(min(u,v)) << 32) | uint64_t(max(u,v));};
+    unordered_set<uint64_t> existing(2 * nb_edges);
+    vector<size_t> bad_edges;
+    for(size_t e = 0; e < nb_edges; e++){
+        edges[e] = {half_edges[2 * e],half_edges[2 * e + 1]};
+        if(edges[e].first == edges[e].second || !existing.insert(key(edges[e].first,edges[e].second)).second){
+            bad_edges.push_back(e); // Loop or second copy of an edge
+        }
+    }
+    long nb_attempts = 0;
+    for(size_t e : bad_edges){
+        while(true){
+            if(++nb_attempts > 1000 * long(nb_edges) + 1000){
+                throw runtime_error("Cannot repair the random regular graph");
+            }
+            size_t f = G() % nb_edges;
+            auto [u,v] = edges[e];
+            auto [x,y] = edges[f];
+            bool f_is_good = (f != e) && (x != y) && existing.count(key(x,y)) 
+                             && find(bad_edges.begin(),bad_edges.end(),f) == bad_edges.end();
+            if(!f_is_good || u == x || v == y || existing.count(key(u,x)) || existing.count(key(v,y)) || key(u,x) == key(v,y)){
+                continue;
+            }
+            existing.erase(key(x,y));
+            existing.insert(key(u,x));
+            existing.insert(key(v,y));
+            edges[e] = {u,x};
+            edges[f] = {v,y};
+            break;
+        }
+    }
+    vector<Eigen::Triplet<double>> triplets;
+    triplets.reserve(2 * nb_edges);
+    for(auto [u,v] : edges){
+        triplets.emplace_back(u,v,1.);
+        triplets.emplace_back(v,u,1.);
+    }
+    SparseMatrix H(matrixsize,matrixsize);
+    H.setFromTriplets(triplets.begin(),triplets.end());
+    return H;
+}
+
+/*
+    Lanczos method for the smallest and the largest eigenvalues of a symmetric sparse matrix.
+    From a random vector v_1, the recurrence  beta_{k+1} v_{k+1} = H v_k - alpha_k v_k - beta_k v_{k-1}  builds an orthonormal basis 
+        of the Krylov space (v, Hv, H^2 v, ...) in which H is the tridiagonal matrix T_k (alpha on the diagonal, beta below). 
+        The extreme eigenvalues of T_k (Ritz values) converge very quickly to the extreme eigenvalues of H.
+    Only the last two vectors are kept (3 vectors of size N in memory). Without reorthogonalization, the rounding errors 
+        make copies of the converged Ritz values appear ("ghosts"), which does not change the extreme values we want.
+    The error on a Ritz value is bounded by |beta_{k+1} s_k|, where s_k is the last component of its eigenvector in T_k : 
+        every 10 iterations we diagonalize T_k (k x k, negligible) and stop when this bound is small for both extremes.
+    (The implicitly restarted versions, like Krylov-Schur in ARPACK, are needed for many eigenvalues ; two extreme ones converge without restart.)
+*/
+struct LanczosResult{
+    double min;
+    double max;
+    int nb_iterations;
+    bool converged;
+};
+
+LanczosResult lanczos_extreme_eigenvalues(const SparseMatrix & H, Xoshiro256 & G, int max_iterations = 500, double tolerance = 1e-8){
+    int matrixsize = H.rows();
+    Eigen::VectorXd v(matrixsize), v_previous = Eigen::VectorXd::Zero(matrixsize), w(matrixsize);
+    fill_normals(G,v.data(),matrixsize,1.);
+    v.normalize();
+    vector<double> alpha, beta;
+    LanczosResult result = {0., 0., 0, false};
+    Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver;
+    for(int k = 1; k <= min(max_iterations,matrixsize); k++){
+        w.noalias() = H * v;
+        alpha.push_back(w.dot(v));
+        w -= alpha.back() * v;
+        if(k > 1){
+            w -= beta.back() * v_previous;
+        }
+        double next_beta = w.norm();
+        bool invariant = next_beta < 1e-12 * max(1.,abs(alpha.back())); // The Krylov space contains exact eigenvectors
+        if(k % 10 == 0 || invariant || k == min(max_iterations,matrixsize)){
+            Eigen::Map<Eigen::VectorXd> diag(alpha.data(),k);
+            Eigen::Map<Eigen::VectorXd> subdiag(beta.data(),k - 1);
+            Solver.computeFromTridiagonal(diag,subdiag,Eigen::ComputeEigenvectors);
+            result.min = Solver.eigenvalues()(0);
+            result.max = Solver.eigenvalues()(k - 1);
+            result.nb_iterations = k;
+            double scale = max({1.,abs(result.min),abs(result.max)});
+            double error_min = abs(next_beta * Solver.eigenvectors()(k - 1,0));
+            double error_max = abs(next_beta * Solver.eigenvectors()(k - 1,k - 1));
+            if(invariant || max(error_min,error_max) < tolerance * scale){
+                result.converged = true;
+                break;
+            }
+        }
+        beta.push_back(next_beta);
+        v_previous.swap(v);
+        v = w / next_beta;
+    }
+    return result;
+}
+
+/*
+    Kernel polynomial method (KPM) : histogram of the eigenvalues of a sparse symmetric matrix without computing them.
+    The spectrum is first mapped into [-1,1] : x = (lambda - center) / half_width, with the extreme eigenvalues given by Lanczos (plus 1%). 
+    The density of eigenvalues is then expanded on the Chebyshev polynomials T_n(cos theta) = cos(n theta) :
+        rho(x) = (mu_0 + 2 sum_{n>=1} g_n mu_n T_n(x)) / (pi sqrt(1 - x^2)),    mu_n = Tr(T_n(H)) / N.
+    - The traces are estimated with nb_vectors random vectors r with coefficients +1 or -1 (E[r^T A r] = Tr(A)) : 
+      T_n(H) r is computed with the recurrence v_{n+1} = 2 H v_n - v_{n-1}, one product H * v per step, and 
+      v_n.v_n and v_{n+1}.v_n give two moments at once (mu_2n = 2 v_n.v_n - mu_0, mu_2n+1 = 2 v_{n+1}.v_n - mu_1).
+    - g_n is the Jackson kernel, which removes the oscillations (Gibbs) of the truncated series ; 
+      the resolution is about pi * half_width / nb_moments.
+    - The number of eigenvalues in a bin [x1,x2] is N times the integral of rho, which is exact for each term : 
+      with theta = arccos(x), the integral of T_n(x) / (pi sqrt(1 - x^2)) is (sin(n theta1) - sin(n theta2)) / (n pi).
+    Cost : nb_moments / 2 * nb_vectors products H * v, that is O(nnz * nb_moments * nb_vectors) instead of O(N^3).
+    The bins are the ones of Histogram(a, b, nb_boxes) for the eigenvalues multiplied by factor (the estimated numbers are rounded) : 
+        the result can be printed or merged like the histograms of the dense matrices.
+*/
+Histogram kpm_spectrum_histogram(const SparseMatrix & H, Xoshiro256 & G, double factor, double a, double b, int nb_boxes, 
+                                 int nb_moments = 200, int nb_vectors = 10){
+    int matrixsize = H.rows();
+    LanczosResult bounds = lanczos_extreme_eigenvalues(H,G,100,1e-4);
+    double center = 0.5 * (bounds.max + bounds.min);
+    double half_width = 0.5 * (bounds.max - bounds.min) * 1.01 + 1e-12;
+
+    // Moments
+    int half = (nb_moments + 1) / 2;
+    vector<double> mu(2 * half, 0.);
+    Eigen::VectorXd r(matrixsize), v_previous(matrixsize), v(matrixsize), v_next(matrixsize);
+    for(int vector_number = 0; vector_number < nb_vectors; vector_number++){
+        for(int i = 0; i < matrixsize; i++){
+            r(i) = (G() >> 63) ? 1. : -1.;
+        }
+        v_previous = r; // T_0(H) r
+        v.noalias() = H * r;
+        v = (v - center * r) / half_width; // T_1(H) r
+        double mu_0 = r.squaredNorm();
+        double mu_1 = r.dot(v);
+        mu[0] += mu_0;
+        mu[1] += mu_1;
+        for(int n = 1; n < half; n++){
+            // v_previous = T_{n-1}(H) r, v = T_n(H) r
+            v_next.noalias() = H * v;
+            v_next = 2. / half_width * (v_next - center * v) - v_previous;
+            mu[2 * n] += 2. * v.squaredNorm() - mu_0;
+            mu[2 * n + 1] += 2. * v_next.dot(v) - mu_1;
+            v_previous.swap(v);
+            v.swap(v_next);
+        }
+    }
+    for(auto & m : mu){
+        m /= double(nb_vectors) * matrixsize;
+    }
+    mu.resize(nb_moments);
+
+    // Jackson kernel and integral of the density on each bin
+    vector<int64_t> bars(nb_boxes);
+    double delta = (b - a) / nb_boxes;
+    auto theta = [&](double edge){ // edge is a normalized eigenvalue
+        double x = (edge / factor - center) / half_width;
+        return acos(max(-1.,min(1.,x)));
+    };
+    int64_t nb_in_box = 0;
+    for(int k = 0; k < nb_boxes; k++){
+        double theta1 = theta(a + k * delta);
+        double theta2 = theta(a + (k + 1) * delta);
+        double mass = mu[0] * (theta1 - theta2) / M_PI;
+        for(int n = 1; n < nb_moments; n++){
+            double g = ((nb_moments - n + 1) * cos(M_PI * n / (nb_moments + 1)) 
+                        + sin(M_PI * n / (nb_moments + 1)) / tan(M_PI / (nb_moments + 1))) / (nb_moments + 1);
+            mass += 2. * g * mu[n] * (sin(n * theta1) - sin(n * theta2)) / (n * M_PI);
+        }
+        bars[k] = max<int64_t>(0,llround(mass * matrixsize));
+        nb_in_box += bars[k];
+    }
+    return Histogram(a,b,bars,max<int64_t>(0,matrixsize - nb_in_box));
+}
+
+/*
+    Cross-check on a matrix small enough to be diagonalized : the KPM histogram must be close to the histogram of the exact eigenvalues 
+        (sum over the bins of |difference| / N, which contains the error of the stochastic trace), and Lanczos must find the extreme eigenvalues.
+    Then the three ensembles with large_size rows (10^4 in main, 10^5 in the benchmarks, where the dense methods are impossible).
+*/
+void check_sparse_spectrum(Xoshiro256 & G, int large_size){
+    int matrixsize = 1000;
+    double mean_degree = 10.;
+    double p = mean_degree / matrixsize;
+    double factor = 1. / sqrt(matrixsize * p * (1. - p));
+    SparseMatrix H = erdos_renyi_matrix(G,matrixsize,p);
+    Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver(MatrixDouble(H),Eigen::EigenvaluesOnly);
+    Histogram exact(-3.,3.,20);
+    exact.insert(Solver.eigenvalues(),factor);
+    Histogram estimated = kpm_spectrum_histogram(H,G,factor,-3.,3.,20);
+    double difference = abs(exact.nb_out_of_domain() - estimated.nb_out_of_domain());
+    for(int k = 0; k < exact.nb_boxes(); k++){
+        difference += abs(exact.count(k) - estimated.count(k));
+    }
+    LanczosResult extremes = lanczos_extreme_eigenvalues(H,G);
+    cout << "Erdos-Renyi N = " << matrixsize << " : KPM / exact histogram difference " << difference / matrixsize 
+         << ", Lanczos [" << extremes.min << ", " << extremes.max << "] in " << extremes.nb_iterations << " iterations, exact [" 
+         << Solver.eigenvalues()(0) << ", " << Solver.eigenvalues()(matrixsize - 1) << "]" << endl;
+
+    struct Ensemble{
+        string name;
+        function<SparseMatrix()> generate;
+        double factor;
+    };
+    int degree = 3;
+    int bandwidth = 5;
+    vector<Ensemble> ensembles = {
+        {"Erdos-Renyi (mean degree 10)", [&](){return erdos_renyi_matrix(G,large_size,mean_degree / large_size);}, 1. / sqrt(mean_degree)}, 
+        {"random 3-regular graph", [&](){return random_regular_graph(G,large_size,degree);}, 1. / sqrt(degree - 1.)}, 
+        {"band matrix (bandwidth 5)", [&](){return band_random_matrix(G,large_size,bandwidth);}, 1. / (2. * sqrt(2. * bandwidth + 1.))}};
+    for(auto & ensemble : ensembles){
+        auto start = timer::now();
+        SparseMatrix M = ensemble.generate();
+        chrono::duration<double> generation = timer::now() - start;
+        start = timer::now();
+        Histogram h = kpm_spectrum_histogram(M,G,ensemble.factor,-3.,3.,20,100,4);
+        LanczosResult extremes = lanczos_extreme_eigenvalues(M,G);
+        chrono::duration<double> estimation = timer::now() - start;
+        cout << ensemble.name << ", N = " << large_size << ", " << M.nonZeros() << " non-zeros : generation " << generation.count() 
+             << " s, KPM + Lanczos " << estimation.count() << " s, extreme eigenvalues (normalized) " 
+             << extremes.min * ensemble.factor << " " << extremes.max * ensemble.factor << endl;
+        ofstream output("EigenValues_sparse_" + to_string(&ensemble - &ensembles[0]) + ".dat");
+        h.print(output);
+    }
+}
+
+/*
+    Checkpoints of parallel_spectrum_histogram.
+    A run of several hours must survive the end of its job (preemption of the node, time limit) : every checkpoint_interval seconds, 
+        the threads stop after their current sample and the state of the run is written in a binary file :
+        - a header : "SPECCKPT", then seed, matrixsize, simul and nb_threads (int64_t) ;
+        - for each thread : the state of its generator, the number of its next sample (int64_t) and the snapshot of its shard of the histogram.
+    The file is first written under another name (filename + ".tmp"), flushed to the disk (fsync), then renamed : 
+        rename replaces the old checkpoint in one operation, so an interruption while writing leaves the previous checkpoint intact. 
+        The rename itself is only on the disk once the directory is flushed too (fsync of the directory).
+    Each thread always computes the same samples, with the same generator, and adds them to its own shard in the same order : 
+        the state of the shards does not depend on the moments of the checkpoints, and a run resumed from a checkpoint 
+        gives exactly the same histogram (same counts and same moments, bit for bit) as a run without interruption.
+*/
+const char checkpoint_magic[8] = {'S','P','E','C','C','K','P','T'};
+
+struct CheckpointHeader{
+    int64_t seed;
+    int64_t matrixsize;
+    int64_t simul;
+    int64_t nb_threads;
+};
+
+/*
+    Set by SIGTERM or SIGINT (see main) : the threads finish their sample, a checkpoint is written and parallel_spectrum_histogram returns.
+*/
+atomic<bool> stop_requested(false);
+
+extern "C" void request_stop(int){
+    stop_requested = true;
+}
+
+void save_checkpoint(const string & filename, const CheckpointHeader & header, const vector<Xoshiro256> & generators, 
+                     const vector<long> & next_sample, const ConcurrentHistogram & h){
+    string temporary = filename + ".tmp";
+    {
+        ofstream output(temporary,ios::binary);
+        output.write(checkpoint_magic,8);
+        output.write(reinterpret_cast<const char *>(&header),sizeof(header));
+        for(int t = 0; t < header.nb_threads; t++){
+            int64_t next = next_sample[t];
+            generators[t].write(output);
+            output.write(reinterpret_cast<const char *>(&next),sizeof(next));
+            h.shard_snapshot(t).write(output);
+        }
+        output.close(); // The buffer is written to the file here : the errors of this last write must be checked too
+        if(!output){
+            throw runtime_error("Cannot write the checkpoint " + temporary);
+        }
+    }
+    int fd = open(temporary.c_str(),O_WRONLY);
+    if(fd < 0){
+        throw runtime_error("Cannot open " + temporary + " to flush it");
+    }
+    bool flushed = (fsync(fd) == 0);
+    close(fd);
+    if(!flushed){
+        throw runtime_error("Cannot flush the checkpoint " + temporary); // The previous checkpoint is not replaced
+    }
+    if(rename(temporary.c_str(),filename.c_str()) != 0){
+        throw runtime_error("Cannot rename " + temporary + " to " + filename);
+    }
+    string directory = filesystem::path(filename).parent_path().string();
+    int directory_fd = open(directory.empty() ? "." : directory.c_str(),O_RDONLY | O_DIRECTORY);
+    if(directory_fd < 0 || fsync(directory_fd) != 0){
+        if(directory_fd >= 0) close(directory_fd);
+        throw runtime_error("Cannot flush the directory of " + filename);
+    }
+    close(directory_fd);
+}
+
+/*
+    Returns false if there is no checkpoint, throws an exception if the file is not a checkpoint.
+*/
+bool read_checkpoint_header(const string & filename, CheckpointHeader & header){
+    ifstream input(filename,ios::binary);
+    if(!input){
+        return false;
+    }
+    char magic[8];
+    input.read(magic,8);
+    input.read(reinterpret_cast<char *>(&header),sizeof(header));
+    if(!input || memcmp(magic,checkpoint_magic,8) != 0){
+        throw runtime_error(filename + " is not a checkpoint file");
+    }
+    return true;
+}
+
+void load_checkpoint(const string & filename, const CheckpointHeader & expected, vector<Xoshiro256> & generators, 
+                     vector<long> & next_sample, ConcurrentHistogram & h){
+    CheckpointHeader header;
+    read_checkpoint_header(filename,header);
+    if(header.seed != expected.seed || header.matrixsize != expected.matrixsize || header.simul != expected.simul 
+       || header.nb_threads != expected.nb_threads){
+        throw runtime_error(filename + " was written by a run with other parameters");
+    }
+    ifstream input(filename,ios::binary);
+    input.seekg(8 + sizeof(header));
+    Histogram shard(h.lower_bound(),h.upper_bound(),h.nb_boxes());
+    for(int t = 0; t < header.nb_threads; t++){
+        int64_t next;
+        generators[t].read(input);
+        input.read(reinterpret_cast<char *>(&next),sizeof(next));
+        next_sample[t] = next;
+        shard.read(input);
+        h.merge(shard,t); // The shard is empty : it becomes a copy of the snapshot
+    }
+}
+
+/*
+    Parallel Monte Carlo driver.
+    The samples are split into nb_threads contiguous chunks of (almost) the same size : every sample costs the same time 
+        (same matrix size), so a static split is enough and no work stealing is needed.
+    Each thread has its own generator and its own SpectrumWorkspace, and all the threads fill the same ConcurrentHistogram 
+        (each one in its own shard) : the eigenvalues of a sample are first binned in a local histogram, which is then merged. 
+        The generator of thread t is the generator seeded with seed, advanced by t jumps of 2^128 numbers, 
+        and the counts do not depend on the order of the insertions : 
+        for a given seed and a given number of threads, the result is always the same.
+    If checkpoint_file is not empty, the run starts from this checkpoint when it exists, and a new checkpoint 
+        is written every checkpoint_interval seconds (see above). If stop_requested becomes true, the function writes a checkpoint 
+        and returns the histogram of the samples already computed. 
+        sample_limit >= 0 stops in the same way once each thread has computed sample_limit samples in this call 
+        (a deterministic interruption, for check_checkpoint_resume).
+*/
+Histogram parallel_spectrum_histogram(unsigned seed, int matrixsize, int simul, int nb_threads, double a, double b, int nb_boxes, 
+                                      const string & checkpoint_file = "", double checkpoint_interval = 600., long sample_limit = -1){
+    ConcurrentHistogram h(a,b,nb_boxes,nb_threads);
+    CheckpointHeader header = {seed, matrixsize, simul, nb_threads};
+    vector<Xoshiro256> generators;
+    vector<long> next_sample(nb_threads);
+    vector<long> last_sample(nb_threads);
+    for(int t = 0; t < nb_threads; t++){
+        generators.push_back(t == 0 ? Xoshiro256(seed) : generators.back());
+        if(t > 0){
+            generators.back().jump();
+        }
+        next_sample[t] = (long(simul) * t) / nb_threads;
+        last_sample[t] = (long(simul) * (t + 1)) / nb_threads;
+    }
+    bool checkpoints = !checkpoint_file.empty();
+    CheckpointHeader existing;
+    if(checkpoints && read_checkpoint_header(checkpoint_file,existing)){
+        load_checkpoint(checkpoint_file,header,generators,next_sample,h);
+    }
+    vector<long> nb_computed(nb_threads, 0); // Samples computed by each thread in this call
+    auto below_limit = [&](int t){return sample_limit < 0 || nb_computed[t] < sample_limit;};
+    auto remaining = [&](){
+        for(int t = 0; t < nb_threads; t++){
+            if(next_sample[t] < last_sample[t] && below_limit(t)) return true;
+        }
+        return false;
+    };
+    while(remaining() && !stop_requested){
+        auto deadline = timer::now() + chrono::duration_cast<timer::duration>(chrono::duration<double>(checkpoints ? checkpoint_interval : 1e9));
+        vector<thread> threads;
+        for(int t = 0; t < nb_threads; t++){
+            threads.emplace_back([&,t](){
+                Xoshiro256 & G = generators[t];
+                SpectrumWorkspace workspace(matrixsize);
+                Histogram sample_histogram(a,b,nb_boxes);
+                double normalization = 1. / (2.*sqrt(matrixsize));
+                while(next_sample[t] < last_sample[t] && below_limit(t)){
+                    const Eigen::VectorXd & spec = workspace.sample(G);
+                    {
+                        PHASE_TIMER(Binning);
+                        sample_histogram.reset();
+                        sample_histogram.insert(spec, normalization);
+                        h.merge(sample_histogram, t);
+                    }
+                    next_sample[t]++;
+                    nb_computed[t]++;
+                    if(stop_requested || timer::now() >= deadline) break; // At least one sample between two checkpoints
+                }
+            });
+        }
+        for(auto & th : threads){
+            th.join();
+        }
+        if(checkpoints){
+            save_checkpoint(checkpoint_file,header,generators,next_sample,h);
+        }
+    }
+    return h.snapshot();
+}
+
+/*
+    A run interrupted after 7 samples per thread (sample_limit, so the interruption does not depend on the speed of the machine) 
+        and resumed from its checkpoint must give the same bytes as a run without interruption. 
+        The checkpoint is written in the temporary directory of the system.
+*/
+bool check_checkpoint_resume(unsigned seed){
+    int matrixsize = 60;
+    int simul = 40;
+    int nb_threads = 2;
+    long sample_limit = 7;
+    string filename = (filesystem::temp_directory_path() / ("checkpoint_test_" + to_string(getpid()) + ".bin")).string();
+    remove(filename.c_str());
+    ostringstream reference, resumed;
+    parallel_spectrum_histogram(seed,matrixsize,simul,nb_threads,-3.,3.,20).write(reference);
+
+    Histogram partial = parallel_spectrum_histogram(seed,matrixsize,simul,nb_threads,-3.,3.,20,filename,0.001,sample_limit);
+    bool stopped = partial.moments().count() == nb_threads * sample_limit * matrixsize && filesystem::exists(filename);
+    parallel_spectrum_histogram(seed,matrixsize,simul,nb_threads,-3.,3.,20,filename,0.001).write(resumed);
+    remove(filename.c_str());
+
+    bool identical = (reference.str() == resumed.str());
+    cout << "Checkpoint after " << partial.moments().count() / matrixsize << " of " << simul << " samples, resumed : " 
+         << (identical ? "identical" : "DIFFERENT") << " to the run without interruption" << endl;
+    if(!stopped){
+        cout << "FAILED : the run was not stopped after " << sample_limit << " samples per thread with a checkpoint" << endl;
+    }
+    return stopped && identical;
+}
+
+/*
+    Benchmark of the generation, diagonalization and histogram functions (see Benchmark.h) :
+        ./Sec4_Random_Matrix_class --benchmark results.json    (or results.csv)
+    Operation counts : about 4/3 N^3 for the reduction of a symmetric matrix to tridiagonal form (the QR iterations on the 
+        tridiagonal matrix are O(N^2)), about 10 N^3 for EigenSolver (Hessenberg + Schur), N(N+1)/2 values for the generation.
+*/
+void run_spectrum_benchmarks(const string & filename){
+    BenchmarkReport report;
+    MT G(1);
+    Xoshiro256 fast_G(1);
+    for(int N : {150, 300, 600}){
+        string parameters = "N=" + to_string(N);
+        double nb_values = 0.5 * N * (N + 1.);
+        MatrixDouble RandomMat(N, N);
+        report.add(run_benchmark("fill_random_matrix", parameters, [&](){fill_random_matrix(G, RandomMat); return RandomMat(0,0);}, 
+                                 0, N * double(N) * sizeof(double)));
+        report.add(run_benchmark("fill_random_lower_triangle", parameters, [&](){fill_random_lower_triangle(fast_G, RandomMat); return RandomMat(0,0);}, 
+                                 0, nb_values * sizeof(double)));
+        SpectrumWorkspace workspace(N);
+        report.add(run_benchmark("SpectrumWorkspace::sample", parameters, [&](){return workspace.sample(fast_G)(0);}, 4. / 3. * N * N * N));
+        if(N <= 300){
+            report.add(run_benchmark("generate_random_spectrum (EigenSolver)", parameters, [&](){return generate_random_spectrum(G, N);}, 
+                                     10. * N * N * N, 0, 1, 3));
+        }
+    }
+    for(int N : {1000, 4000}){
+        Eigen::VectorXd diag(N), subdiag(N - 1), spec(N);
+        Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver;
+        report.add(run_benchmark("generate_beta_spectrum", "N=" + to_string(N) + " beta=1", 
+                                 [&](){generate_beta_spectrum(G, 1., diag, subdiag, Solver, spec); return spec(0);}, 0, 0, 1, 5));
+        Histogram h(-3., 3., 20);
+        vector<double> points;
+        vector<int64_t> counts;
+        report.add(run_benchmark("sturm_histogram", "N=" + to_string(N) + " K=20", 
+                                 [&](){sturm_histogram(diag, subdiag, 1. / (2.*sqrt(N)), h, points, counts); return h.nb_out_of_domain();}, 
+                                 3. * N * 21));
+    }
+    vector<double> values(1000000);
+    normal_distribution<double> distribution(0, 1);
+    for(auto & x : values){
+        x = distribution(G);
+    }
+    vector<double> sorted_values = values;
+    sort(sorted_values.begin(), sorted_values.end());
+    for(int nb_boxes : {20, 1000}){
+        for(auto data : {&values, &sorted_values}){
+            string order = (data == &values) ? " random" : " sorted";
+            report.add(run_benchmark("Histogram::operator+=", "values=1000000" + order + " K=" + to_string(nb_boxes), [&](){
+                Histogram h(-3., 3., nb_boxes);
+                for(double x : *data){
+                    h += x;
+                }
+                return h.nb_out_of_domain();
+            }, 3. * values.size(), values.size() * sizeof(double)));
+            report.add(run_benchmark("Histogram::insert", "values=1000000" + order + " K=" + to_string(nb_boxes), [&](){
+                Histogram h(-3., 3., nb_boxes);
+                h.insert(Eigen::Map<const Eigen::VectorXd>(data->data(), data->size()));
+                return h.nb_out_of_domain();
+            }, 3. * values.size(), values.size() * sizeof(double)));
+        }
+    }
+    int nb_threads = max(1u, thread::hardware_concurrency());
+    report.add(run_benchmark("ConcurrentHistogram::add", "values=1000000 K=20 threads=" + to_string(nb_threads), [&](){
+        ConcurrentHistogram h(-3., 3., 20, nb_threads);
+        vector<thread> threads;
+        for(int t = 0; t < nb_threads; t++){
+            threads.emplace_back([&, t](){
+                for(double x : values){
+                    h.add(x, t);
+                }
+            });
+        }
+        for(auto & th : threads){
+            th.join();
+        }
+        return h.snapshot().nb_out_of_domain();
+    }, 3. * values.size() * nb_threads, values.size() * nb_threads * sizeof(double)));
+    save_benchmark_report(report, filename);
+
+    // Sparse ensembles at a size where the dense methods are impossible (10^6 also works in a few tens of seconds)
+    Xoshiro256 sparse_G(1);
+    check_sparse_spectrum(sparse_G,100000);
+}
+
+int main(int argc, char ** argv){
+    if(argc == 3 && string(argv[1]) == "--benchmark"){
+        run_spectrum_benchmarks(argv[2]);
+        return 0;
+    }
+
+
     // Parameters
     const int matrixsize = 150;
     const int nb_boxes = 20;
     double a=-3.;
     double b=3.;
     int simul = 50;
-    MT G(time(nullptr));
+    unsigned seed = time(nullptr);
+    int nb_threads = max(1u,thread::hardware_concurrency());
+
+    /*
+        ./Sec4_Random_Matrix_class --checkpoint run.ckpt [interval in seconds]
+        writes a checkpoint regularly ; if run.ckpt already exists, the run continues from it, with its seed and its number of threads.
+        SIGTERM (sent by most job schedulers before stopping a job) or Ctrl-C writes a last checkpoint and stops the program.
+    */
+    string checkpoint_file;
+    double checkpoint_interval = 600.;
+    if(argc >= 3 && string(argv[1]) == "--checkpoint"){
+        checkpoint_file = argv[2];
+        if(argc >= 4) checkpoint_interval = stod(argv[3]);
+        CheckpointHeader header;
+        if(read_checkpoint_header(checkpoint_file,header)){
+            seed = header.seed;
+            nb_threads = header.nb_threads;
+            cout << "Resuming from " << checkpoint_file << endl;
+        }
+        signal(SIGTERM,request_stop);
+        signal(SIGINT,request_stop);
+    }
+    MT G(seed);
+    cout << "Seed : " << seed << ", number of threads : " << nb_threads << endl;
 
 
     chrono::duration<double> process;
     auto start = timer::now();
-    Histogram h(a,b,nb_boxes);
-    for(int sampl = 0; sampl < simul; sampl++){
-        auto spec = generate_random_spectrum(G,matrixsize);
-        for(auto lambda : spec){
-            h += lambda.real() / (2.*sqrt(matrixsize));
-        }
-    } 
+    Histogram h = parallel_spectrum_histogram(seed,matrixsize,simul,nb_threads,a,b,nb_boxes,checkpoint_file,checkpoint_interval);
     auto end = timer::now();
     process = end - start;
+    if(stop_requested){
+        cout << "Stopped after " << process.count() << " s, the state is saved in " << checkpoint_file << endl;
+        return 0;
+    }
     cout << "End of the process : " << process.count() <<" s"<< endl;
+    cout << "Normalized eigenvalues : ";
+    h.moments().print(cout);
+    cout << "\n(semicircle law on [-2,2] : mean 0, variance 1, skewness 0, excess kurtosis -1)" << endl;
     
     { 
         ofstream output("EigenValues_class.dat");
         h.print(output);
         output.close();
     }
+
+    // Same histogram with the tridiagonal model (beta = 1 gives the GOE)
+    {
+        double beta = 1.;
+        Histogram h_beta(a,b,nb_boxes);
+        Eigen::VectorXd diag(matrixsize), subdiag(matrixsize - 1), spec(matrixsize);
+        Eigen::SelfAdjointEigenSolver<MatrixDouble> Solver;
+        start = timer::now();
+        for(int sampl = 0; sampl < simul; sampl++){
+            generate_beta_spectrum(G,beta,diag,subdiag,Solver,spec);
+            PHASE_TIMER(Binning);
+            h_beta.insert(spec, 1. / (2.*sqrt(matrixsize)));
+        }
+        process = timer::now() - start;
+        cout << "End of the process (tridiagonal model, beta = " << beta << ") : " << process.count() << " s" << endl;
+        ofstream output("EigenValues_beta.dat");
+        h_beta.print(output);
+        output.close();
+
+        // The tridiagonal model allows much larger matrices
+        int large_size = 5000;
+        Eigen::VectorXd large_diag(large_size), large_subdiag(large_size - 1), large_spec(large_size);
+        start = timer::now();
+        generate_beta_spectrum(G,beta,large_diag,large_subdiag,Solver,large_spec);
+        process = timer::now() - start;
+        cout << "One sample of size " << large_size << " with the tridiagonal model : " << process.count() << " s" << endl;
+    }
+
+    Xoshiro256 check_G(seed);
+    if(!check_histogram_insert(G,10000) || !check_checkpoint_resume(seed) || !check_sturm_histogram(check_G,matrixsize,50)){
+        return 1;
+    }
+
+    // Comparison between the general solver and the symmetric one
+    compare_matrix_fillers(G,matrixsize,200);
+    compare_spectrum_solvers(G,{150,500},3); // Add 1000 or 2000 to the list for larger sizes (EigenSolver takes several seconds per sample)
+
+    // Float and mixed precision
+    precision_report(check_G,{150,500,1000},5);
+
+    // Sparse ensembles : KPM and Lanczos (10^4 here, 10^5 with --benchmark)
+    Xoshiro256 sparse_G(seed);
+    check_sparse_spectrum(sparse_G,10000);
+
+#if defined(COUNT_ALLOCATIONS) && defined(__GLIBC__)
+    // Check that SpectrumWorkspace does not allocate memory after the warm-up
+    {
+        SpectrumWorkspace workspace(matrixsize);
+        workspace.sample(G);
+        long nb_allocations_before = nb_allocations;
+        for(int sampl = 0; sampl < 10; sampl++){
+            workspace.sample(G);
+        }
+        long nb_allocations_samples = nb_allocations - nb_allocations_before;
+        cout << "Heap allocations during 10 samples after warm-up : " << nb_allocations_samples << endl;
+        if(nb_allocations_samples != 0){
+            cout << "FAILED : SpectrumWorkspace::sample allocates memory" << endl;
+            return 1;
+        }
+    }
+#endif
+
+    print_phase_report(cout,spectrum_phase_names); // Only with -DINSTRUMENTATION
+
     // CONCLUSION
     // 1/ This program is much more readable than the previous one.
     // 2/ Each step is independently testable from the others.